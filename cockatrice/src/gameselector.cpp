@@ -289,6 +289,12 @@ void GameSelector::processGameInfo(const ServerInfo_Game &info)
     updateTitle();
 }
 
+void GameSelector::processGameInfoList(const QList<ServerInfo_Game> &infoList)
+{
+    gameListModel->updateGameList(infoList);
+    updateTitle();
+}
+
 void GameSelector::actSelectedGameChanged(const QModelIndex &current, const QModelIndex & /* previous */)
 {
     if (!current.isValid())
@@ -61,6 +61,7 @@ public:
                  QWidget *parent = nullptr);
     void retranslateUi();
     void processGameInfo(const ServerInfo_Game &info);
+    void processGameInfoList(const QList<ServerInfo_Game> &infoList);
 };
 
 #endif
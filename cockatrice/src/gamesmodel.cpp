@@ -8,9 +8,12 @@
 
 #include <QDateTime>
 #include <QDebug>
+#include <QHash>
 #include <QIcon>
 #include <QStringList>
 #include <QTime>
+#include <algorithm>
+#include <functional>
 
 enum GameListColumn
 {
@@ -265,23 +268,66 @@ const ServerInfo_Game &GamesModel::getGame(int row)
 
 void GamesModel::updateGameList(const ServerInfo_Game &game)
 {
-    for (int i = 0; i < gameList.size(); i++) {
-        if (gameList[i].game_id() == game.game_id()) {
+    updateGameList(QList<ServerInfo_Game>() << game);
+}
+
+void GamesModel::updateGameList(const QList<ServerInfo_Game> &games)
+{
+    QHash<int, int> rows;
+    for (int i = 0; i < gameList.size(); ++i)
+        rows.insert(gameList[i].game_id(), i);
+
+    QSet<int> closedRows;
+    QList<ServerInfo_Game> newGames;
+    int firstChangedRow = gameList.size(), lastChangedRow = -1;
+    for (const ServerInfo_Game &game : games) {
+        auto row = rows.constFind(game.game_id());
+        if (row != rows.constEnd() && row.value() < gameList.size()) {
+            if (game.closed()) {
+                closedRows.insert(row.value());
+            } else {
+                ServerInfo_Game &listedGame = gameList[row.value()];
+                if (game.game_types_size() > 0)
+                    listedGame.clear_game_types();
+                listedGame.MergeFrom(game);
+                firstChangedRow = qMin(firstChangedRow, row.value());
+                lastChangedRow = qMax(lastChangedRow, row.value());
+            }
+        } else if (row != rows.constEnd()) {
+            // added earlier in this batch
+            const int newIndex = row.value() - gameList.size();
             if (game.closed()) {
-                beginRemoveRows(QModelIndex(), i, i);
-                gameList.removeAt(i);
-                endRemoveRows();
+                newGames[newIndex].Clear();
             } else {
-                gameList[i].MergeFrom(game);
-                emit dataChanged(index(i, 0), index(i, NUM_COLS - 1));
+                if (game.game_types_size() > 0)
+                    newGames[newIndex].clear_game_types();
+                newGames[newIndex].MergeFrom(game);
             }
-            return;
+        } else if (game.player_count() > 0) {
+            rows.insert(game.game_id(), gameList.size() + newGames.size());
+            newGames.append(game);
         }
     }
-    if (game.player_count() <= 0)
+
+    if (lastChangedRow >= 0)
+        emit dataChanged(index(firstChangedRow, 0), index(lastChangedRow, NUM_COLS - 1));
+
+    QList<int> closedRowList = closedRows.values();
+    std::sort(closedRowList.begin(), closedRowList.end(), std::greater<int>());
+    for (int row : closedRowList) {
+        beginRemoveRows(QModelIndex(), row, row);
+        gameList.removeAt(row);
+        endRemoveRows();
+    }
+
+    // games closed within the same batch have been cleared
+    for (int i = newGames.size() - 1; i >= 0; --i)
+        if (!newGames[i].has_game_id())
+            newGames.removeAt(i);
+    if (newGames.isEmpty())
         return;
-    beginInsertRows(QModelIndex(), gameList.size(), gameList.size());
-    gameList.append(game);
+    beginInsertRows(QModelIndex(), gameList.size(), gameList.size() + newGames.size() - 1);
+    gameList.append(newGames);
     endInsertRows();
 }
 
@@ -43,6 +43,10 @@ public:
      * Update game list with a (possibly new) game.
      */
     void updateGameList(const ServerInfo_Game &game);
+    /**
+     * Update game list with a batch of (possibly new) games, as received in one event.
+     */
+    void updateGameList(const QList<ServerInfo_Game> &games);
 
     int roomColIndex()
     {
@@ -40,6 +40,7 @@ ServerInfo_User LocalServer_DatabaseInterface::getUserData(const QString &name,
 AuthenticationResult LocalServer_DatabaseInterface::checkUserPassword(Server_ProtocolHandler * /* handler */,
                                                                       const QString & /* user */,
                                                                       const QString & /* password */,
+                                                                      const QString & /* passwordHash */,
                                                                       const QString & /* clientId */,
                                                                       QString & /* reasonStr */,
                                                                       int & /* secondsLeft */)
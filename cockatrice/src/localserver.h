@@ -30,6 +30,7 @@ public:
     AuthenticationResult checkUserPassword(Server_ProtocolHandler *handler,
                                            const QString &user,
                                            const QString &password,
+                                           const QString &passwordHash,
                                            const QString &clientId,
                                            QString &reasonStr,
                                            int &secondsLeft);
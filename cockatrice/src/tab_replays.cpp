@@ -15,6 +15,7 @@
 
 #include <QAction>
 #include <QApplication>
+#include <QFile>
 #include <QFileSystemModel>
 #include <QGroupBox>
 #include <QHBoxLayout>
@@ -25,7 +26,8 @@
 #include <QTreeView>
 #include <QVBoxLayout>
 
-TabReplays::TabReplays(TabSupervisor *_tabSupervisor, AbstractClient *_client) : Tab(_tabSupervisor), client(_client)
+TabReplays::TabReplays(TabSupervisor *_tabSupervisor, AbstractClient *_client)
+    : Tab(_tabSupervisor), client(_client), lastReplayDownloadId(0)
 {
     localDirModel = new QFileSystemModel(this);
     localDirModel->setRootPath(SettingsCache::instance().getReplaysPath());
@@ -160,25 +162,7 @@ void TabReplays::actOpenRemoteReplay()
     if (!curRight)
         return;
 
-    Command_ReplayDownload cmd;
-    cmd.set_replay_id(curRight->replay_id());
-
-    PendingCommand *pend = client->prepareSessionCommand(cmd);
-    connect(pend, SIGNAL(finished(Response, CommandContainer, QVariant)), this,
-            SLOT(openRemoteReplayFinished(const Response &)));
-    client->sendCommand(pend);
-}
-
-void TabReplays::openRemoteReplayFinished(const Response &r)
-{
-    if (r.response_code() != Response::RespOk)
-        return;
-
-    const Response_ReplayDownload &resp = r.GetExtension(Response_ReplayDownload::ext);
-    GameReplay *replay = new GameReplay;
-    replay->ParseFromString(resp.replay_data());
-
-    emit openReplay(replay);
+    startReplayDownload(curRight->replay_id(), QString());
 }
 
 void TabReplays::actDownload()
@@ -203,31 +187,102 @@ void TabReplays::actDownload()
 
     filePath += QString("/replay_%1.cor").arg(curRight->replay_id());
 
+    startReplayDownload(curRight->replay_id(), filePath);
+}
+
+void TabReplays::startReplayDownload(int replayId, const QString &filePath)
+{
+    ReplayDownload download;
+    download.replayId = replayId;
+    download.filePath = filePath;
+    download.received = 0;
+
+    const int downloadId = ++lastReplayDownloadId;
+    replayDownloads.insert(downloadId, download);
+    if (!filePath.isEmpty())
+        QFile::remove(filePath + ".part");
+
+    requestReplayChunk(downloadId);
+}
+
+void TabReplays::requestReplayChunk(int downloadId)
+{
+    const ReplayDownload &download = replayDownloads[downloadId];
+
     Command_ReplayDownload cmd;
-    cmd.set_replay_id(curRight->replay_id());
+    cmd.set_replay_id(download.replayId);
+    cmd.set_offset(download.received);
+    cmd.set_max_length(replayChunkSize);
 
     PendingCommand *pend = client->prepareSessionCommand(cmd);
-    pend->setExtraData(filePath);
+    pend->setExtraData(downloadId);
     connect(pend, SIGNAL(finished(Response, CommandContainer, QVariant)), this,
-            SLOT(downloadFinished(Response, CommandContainer, QVariant)));
+            SLOT(replayChunkReceived(Response, CommandContainer, QVariant)));
     client->sendCommand(pend);
 }
 
-void TabReplays::downloadFinished(const Response &r,
-                                  const CommandContainer & /* commandContainer */,
-                                  const QVariant &extraData)
+void TabReplays::replayChunkReceived(const Response &r,
+                                     const CommandContainer & /* commandContainer */,
+                                     const QVariant &extraData)
 {
-    if (r.response_code() != Response::RespOk)
+    const int downloadId = extraData.toInt();
+    if (!replayDownloads.contains(downloadId))
         return;
+    ReplayDownload download = replayDownloads.take(downloadId);
+    const QString partFilePath = download.filePath + ".part";
+
+    if (r.response_code() != Response::RespOk) {
+        if (!download.filePath.isEmpty())
+            QFile::remove(partFilePath);
+        return;
+    }
 
     const Response_ReplayDownload &resp = r.GetExtension(Response_ReplayDownload::ext);
-    QString filePath = extraData.toString();
+    const std::string &chunk = resp.replay_data();
 
-    const std::string &data = resp.replay_data();
-    QFile f(filePath);
-    f.open(QIODevice::WriteOnly);
-    f.write((const char *)data.data(), data.size());
-    f.close();
+    // servers without chunked downloads answer with the whole replay and no total size
+    const bool chunked = resp.has_total_size();
+    if (chunked && resp.offset() != download.received) {
+        if (!download.filePath.isEmpty())
+            QFile::remove(partFilePath);
+        return;
+    }
+
+    // replays to be opened are assembled in memory, downloads are appended to the file chunk by chunk
+    if (download.filePath.isEmpty())
+        download.data.append(chunk.data(), static_cast<int>(chunk.size()));
+    else {
+        QFile f(partFilePath);
+        if (!f.open(QIODevice::WriteOnly | QIODevice::Append) ||
+            f.write(chunk.data(), static_cast<qint64>(chunk.size())) != static_cast<qint64>(chunk.size())) {
+            f.close();
+            QFile::remove(partFilePath);
+            return;
+        }
+    }
+    download.received += chunk.size();
+
+    if (chunked && download.received < resp.total_size()) {
+        // an empty chunk before the end means the replay changed or is gone, don't loop forever
+        if (chunk.empty()) {
+            if (!download.filePath.isEmpty())
+                QFile::remove(partFilePath);
+            return;
+        }
+        replayDownloads.insert(downloadId, download);
+        requestReplayChunk(downloadId);
+        return;
+    }
+
+    if (download.filePath.isEmpty()) {
+        GameReplay *replay = new GameReplay;
+        replay->ParseFromArray(download.data.data(), download.data.size());
+
+        emit openReplay(replay);
+    } else {
+        QFile::remove(download.filePath);
+        QFile::rename(partFilePath, download.filePath);
+    }
 }
 
 void TabReplays::actKeepRemoteReplay()
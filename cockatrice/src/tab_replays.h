@@ -3,6 +3,9 @@
 
 #include "tab.h"
 
+#include <QByteArray>
+#include <QMap>
+
 class Response;
 class AbstractClient;
 class QTreeView;
@@ -26,16 +29,29 @@ private:
     QGroupBox *leftGroupBox, *rightGroupBox;
 
     QAction *aOpenLocalReplay, *aDeleteLocalReplay, *aOpenRemoteReplay, *aDownload, *aKeep, *aDeleteRemoteReplay;
+
+    // Remote replays are fetched in chunks, the next one is requested when the previous one arrived
+    struct ReplayDownload
+    {
+        int replayId;
+        QString filePath; // empty: open the replay once complete
+        QByteArray data;
+        quint64 received;
+    };
+    static const int replayChunkSize = 1024 * 1024;
+    int lastReplayDownloadId;
+    QMap<int, ReplayDownload> replayDownloads;
+
+    void startReplayDownload(int replayId, const QString &filePath);
+    void requestReplayChunk(int downloadId);
 private slots:
     void actOpenLocalReplay();
 
     void actDeleteLocalReplay();
 
     void actOpenRemoteReplay();
-    void openRemoteReplayFinished(const Response &r);
-
     void actDownload();
-    void downloadFinished(const Response &r, const CommandContainer &commandContainer, const QVariant &extraData);
+    void replayChunkReceived(const Response &r, const CommandContainer &commandContainer, const QVariant &extraData);
 
     void actKeepRemoteReplay();
     void keepRemoteReplayFinished(const Response &r, const CommandContainer &commandContainer);
@@ -111,9 +111,11 @@ TabRoom::TabRoom(TabSupervisor *_tabSupervisor,
     }
     userList->sortItems();
 
+    QList<ServerInfo_Game> gameList;
     const int gameListSize = info.game_list_size();
     for (int i = 0; i < gameListSize; ++i)
-        gameSelector->processGameInfo(info.game_list(i));
+        gameList.append(info.game_list(i));
+    gameSelector->processGameInfoList(gameList);
 
     completer = new QCompleter(autocompleteUserList, sayEdit);
     completer->setCaseSensitivity(Qt::CaseInsensitive);
@@ -258,9 +260,11 @@ void TabRoom::processRoomEvent(const RoomEvent &event)
 
 void TabRoom::processListGamesEvent(const Event_ListGames &event)
 {
+    QList<ServerInfo_Game> gameList;
     const int gameListSize = event.game_list_size();
     for (int i = 0; i < gameListSize; ++i)
-        gameSelector->processGameInfo(event.game_list(i));
+        gameList.append(event.game_list(i));
+    gameSelector->processGameInfoList(gameList);
 }
 
 void TabRoom::processJoinRoomEvent(const Event_JoinRoom &event)
@@ -72,6 +72,8 @@ void RoomSelector::processListRoomsEvent(const Event_ListRooms &event)
     for (int i = 0; i < roomListSize; ++i) {
         const ServerInfo_Room &room = event.room_list(i);
 
+        // an event may carry several rooms, a known room must not end the processing of the others
+        bool knownRoom = false;
         for (int j = 0; j < roomList->topLevelItemCount(); ++j) {
             QTreeWidgetItem *twi = roomList->topLevelItem(j);
             if (twi->data(0, Qt::UserRole).toInt() == room.room_id()) {
@@ -85,9 +87,13 @@ void RoomSelector::processListRoomsEvent(const Event_ListRooms &event)
                     twi->setData(3, Qt::DisplayRole, room.player_count());
                 if (room.has_game_count())
                     twi->setData(4, Qt::DisplayRole, room.game_count());
-                return;
+                knownRoom = true;
+                break;
             }
         }
+        if (knownRoom)
+            continue;
+
         QTreeWidgetItem *twi = new QTreeWidgetItem;
         twi->setData(0, Qt::UserRole, room.room_id());
         if (room.has_name())
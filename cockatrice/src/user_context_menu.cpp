@@ -92,10 +92,11 @@ void UserContextMenu::gamesOfUserReceived(const Response &resp, const CommandCon
 
     GameSelector *selector = new GameSelector(client, tabSupervisor, nullptr, roomMap, gameTypeMap, false, false);
     selector->setParent(static_cast<QWidget *>(parent()), Qt::Window);
+    QList<ServerInfo_Game> gameList;
     const int gameListSize = response.game_list_size();
-    for (int i = 0; i < gameListSize; ++i) {
-        selector->processGameInfo(response.game_list(i));
-    }
+    for (int i = 0; i < gameListSize; ++i)
+        gameList.append(response.game_list(i));
+    selector->processGameInfoList(gameList);
 
     selector->setWindowTitle(tr("%1's games").arg(QString::fromStdString(cmd.user_name())));
     selector->setMinimumWidth(800);
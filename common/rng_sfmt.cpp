@@ -3,6 +3,7 @@
 #include <QDateTime>
 #include <algorithm>
 #include <climits>
+#include <random>
 #include <stdexcept>
 
 // This is from gcc sources, namely from fixincludes/inclhack.def
@@ -13,8 +14,48 @@
 
 RNG_SFMT::RNG_SFMT(QObject *parent) : RNG_Abstract(parent)
 {
-    // initialize the random number generator with a 32bit integer seed (timestamp)
-    sfmt_init_gen_rand(&sfmt, QDateTime::currentDateTime().toTime_t());
+    // initialize the master generator with 128 bits from the system entropy source; the current time is
+    // mixed in as well in case std::random_device is deterministic on this platform
+    std::random_device entropy;
+    const quint64 now = (quint64)QDateTime::currentMSecsSinceEpoch();
+    uint32_t seed[6] = {entropy(), entropy(), entropy(), entropy(), (uint32_t)now, (uint32_t)(now >> 32)};
+    sfmt_init_by_array(&seedSource, seed, 6);
+}
+
+/**
+ * Returns the SFMT state of the calling thread, creating and seeding it on first use.
+ * Each stream is seeded with 128 bits drawn from the master generator.
+ */
+sfmt_t *RNG_SFMT::localStream()
+{
+    if (!streams.hasLocalData()) {
+        uint32_t seed[4];
+        seedMutex.lock();
+        for (int i = 0; i < 4; ++i)
+            seed[i] = sfmt_genrand_uint32(&seedSource);
+        seedMutex.unlock();
+
+        auto *stream = new Stream;
+        sfmt_init_by_array(&stream->sfmt, seed, 4);
+        streams.setLocalData(stream);
+    }
+    return &streams.localData()->sfmt;
+}
+
+unsigned int RNG_SFMT::rand(int min, int max)
+{
+    return generate(localStream(), min, max);
+}
+
+RNG_SFMT_Seeded::RNG_SFMT_Seeded(quint32 seed, quint32 streamId, QObject *parent) : RNG_Abstract(parent)
+{
+    uint32_t key[2] = {seed, streamId};
+    sfmt_init_by_array(&sfmt, key, 2);
+}
+
+unsigned int RNG_SFMT_Seeded::rand(int min, int max)
+{
+    return RNG_SFMT::generate(&sfmt, min, max);
 }
 
 /**
@@ -26,7 +67,7 @@ RNG_SFMT::RNG_SFMT(QObject *parent) : RNG_Abstract(parent)
  * It is only necessary that the upper bound is larger or equal to the lower bound - with the exception
  * that someone wants something like rand() % -foo.
  */
-unsigned int RNG_SFMT::rand(int min, int max)
+unsigned int RNG_SFMT::generate(sfmt_t *sfmt, int min, int max)
 {
     /* If min is negative, it would be possible to calculate
      * cdf(0, max - min) + min
@@ -48,11 +89,11 @@ unsigned int RNG_SFMT::rand(int min, int max)
     // This is the only time where min > max is (sort of) legal.
     // Not handling this will cause the application to crash.
     if (min == 0 && max < 0) {
-        return -cdf(0, -max);
+        return -cdf(sfmt, 0, -max);
     }
 
     // No special cases are left, except !(min > max) which is caught in the cdf itself.
-    return cdf(min, max);
+    return cdf(sfmt, min, max);
 }
 
 /**
@@ -97,7 +138,7 @@ unsigned int RNG_SFMT::rand(int min, int max)
  * Otherwise you will probably skew the outcome of the rand() method or worsen the
  * performance of the application.
  */
-unsigned int RNG_SFMT::cdf(unsigned int min, unsigned int max)
+unsigned int RNG_SFMT::cdf(sfmt_t *sfmt, unsigned int min, unsigned int max)
 {
     // This all makes no sense if min > max, which should never happen.
     if (min > max) {
@@ -121,13 +162,11 @@ unsigned int RNG_SFMT::cdf(unsigned int min, unsigned int max)
     const uint64_t limit = diameter * buckets;
 
     uint64_t rand;
-    // To make the random number generation thread-safe, a mutex is created around
-    // the generation. Outside of the loop of course, to avoid lock/unlock overhead.
-    mutex.lock();
+    // The state is owned by the calling thread (or serialized by the owner of a seeded stream),
+    // so no locking is needed here.
     do {
-        rand = sfmt_genrand_uint64(&sfmt);
+        rand = sfmt_genrand_uint64(sfmt);
     } while (rand >= limit);
-    mutex.unlock();
 
     // Now determine the bucket containing the SFMT() random number and after adding
     // the lower bound, a random number from [min, max] can be returned.
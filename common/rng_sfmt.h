@@ -5,6 +5,7 @@
 #include "sfmt/SFMT.h"
 
 #include <QMutex>
+#include <QThreadStorage>
 #include <climits>
 
 /**
@@ -24,20 +25,50 @@
  * These are mapped to values from the interval [min, max] without bias by using Knuth's
  * "Algorithm S (Selection sampling technique)" from "The Art of Computer Programming 3rd
  * Edition Volume 2 / Seminumerical Algorithms".
+ *
+ * Every thread draws from its own SFMT stream, so rand() never takes a lock. The streams are
+ * seeded from a master generator which is only touched the first time a thread calls rand().
  */
 
 class RNG_SFMT : public RNG_Abstract
 {
     Q_OBJECT
 private:
-    QMutex mutex;
-    sfmt_t sfmt;
-    // The discrete cumulative distribution function for the RNG
-    unsigned int cdf(unsigned int min, unsigned int max);
+    struct Stream
+    {
+        sfmt_t sfmt;
+    };
+
+    QMutex seedMutex;
+    sfmt_t seedSource;
+    QThreadStorage<Stream *> streams;
+
+    sfmt_t *localStream();
 
 public:
     RNG_SFMT(QObject *parent = 0);
-    unsigned int rand(int min, int max);
+    unsigned int rand(int min, int max) override;
+
+    // rand() on a caller owned SFMT state, see RNG_SFMT_Seeded
+    static unsigned int generate(sfmt_t *sfmt, int min, int max);
+    // The discrete cumulative distribution function for the RNG
+    static unsigned int cdf(sfmt_t *sfmt, unsigned int min, unsigned int max);
+};
+
+/**
+ * A single SFMT stream seeded from a fixed seed and a stream id (e.g. the game id), used to make the
+ * random numbers of one game reproducible.
+ * It is not thread-safe; the owner has to serialize access (e.g. with the game mutex).
+ */
+class RNG_SFMT_Seeded : public RNG_Abstract
+{
+    Q_OBJECT
+private:
+    sfmt_t sfmt;
+
+public:
+    RNG_SFMT_Seeded(quint32 seed, quint32 streamId, QObject *parent = 0);
+    unsigned int rand(int min, int max) override;
 };
 
 #endif
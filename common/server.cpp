@@ -38,8 +38,11 @@
 #include <QCoreApplication>
 #include <QDebug>
 #include <QThread>
+#include <QTimer>
 
-Server::Server(QObject *parent) : QObject(parent), nextLocalGameId(0), tcpUserCount(0), webSocketUserCount(0)
+Server::Server(QObject *parent)
+    : QObject(parent), nextLocalGameId(0), tcpUserCount(0), webSocketUserCount(0), pendingRoomUpdatesToIsl(false),
+      flushedRoomListGeneration(0)
 {
     qRegisterMetaType<ServerInfo_Ban>("ServerInfo_Ban");
     qRegisterMetaType<ServerInfo_Game>("ServerInfo_Game");
@@ -53,16 +56,22 @@ Server::Server(QObject *parent) : QObject(parent), nextLocalGameId(0), tcpUserCo
 
     connect(this, SIGNAL(sigSendIslMessage(IslMessage, int)), this, SLOT(doSendIslMessage(IslMessage, int)),
             Qt::QueuedConnection);
+
+    roomUpdateTimer = new QTimer(this);
+    roomUpdateTimer->setSingleShot(true);
+    connect(roomUpdateTimer, SIGNAL(timeout()), this, SLOT(flushRoomUpdates()));
 }
 
 void Server::prepareDestroy()
 {
+    // The rooms are deleted without roomsLock held: deleting their games waits for the connection pool
+    // threads, which may need roomsLock meanwhile.
     roomsLock.lockForWrite();
-    QMapIterator<int, Server_Room *> roomIterator(rooms);
-    while (roomIterator.hasNext())
-        delete roomIterator.next().value();
+    const QList<Server_Room *> roomList = rooms.values();
     rooms.clear();
     roomsLock.unlock();
+    for (Server_Room *room : roomList)
+        delete room;
 }
 
 void Server::setDatabaseInterface(Server_DatabaseInterface *_databaseInterface)
@@ -79,6 +88,7 @@ Server_DatabaseInterface *Server::getDatabaseInterface() const
 AuthenticationResult Server::loginUser(Server_ProtocolHandler *session,
                                        QString &name,
                                        const QString &password,
+                                       const QString &passwordHash,
                                        QString &reasonStr,
                                        int &secondsLeft,
                                        QString &clientid,
@@ -91,7 +101,7 @@ AuthenticationResult Server::loginUser(Server_ProtocolHandler *session,
     Server_DatabaseInterface *databaseInterface = getDatabaseInterface();
 
     AuthenticationResult authState =
-        databaseInterface->checkUserPassword(session, name, password, clientid, reasonStr, secondsLeft);
+        databaseInterface->checkUserPassword(session, name, password, passwordHash, clientid, reasonStr, secondsLeft);
     if (authState == NotLoggedIn || authState == UserIsBanned || authState == UsernameInvalid ||
         authState == UserIsInactive)
         return authState;
@@ -100,54 +110,70 @@ AuthenticationResult Server::loginUser(Server_ProtocolHandler *session,
     data.set_address(session->getAddress().toStdString());
     name = QString::fromStdString(data.name()); // Compensate for case indifference
 
+    // The checks below run without clientsLock, so that no database round trip happens under it. Names are
+    // claimed under the lock right before the session is started: guests reserve a free name, and a
+    // registered user replaces and logs out any session of the same user that got in meanwhile.
     if (authState == PasswordRight) {
-        if (users.contains(name) || databaseInterface->userSessionExists(name)) {
-            if (users.contains(name)) {
-                qDebug("Session already logged in, logging old session out");
-                Event_ConnectionClosed event;
-                event.set_reason(Event_ConnectionClosed::LOGGEDINELSEWERE);
-                event.set_reason_str("You have been logged out due to logging in at another location.");
-                event.set_end_time(QDateTime::currentDateTime().toTime_t());
-
-                SessionEvent *se = users.value(name)->prepareSessionEvent(event);
-                users.value(name)->sendProtocolItem(*se);
-                delete se;
-
-                users.value(name)->prepareDestroy();
-            } else {
-                qDebug() << "Active session and sessions table inconsistent, please validate session table information "
-                            "for user "
-                         << name;
-            }
-        }
+        clientsLock.lockForRead();
+        const bool loggedIn = users.contains(name);
+        clientsLock.unlock();
+        if (!loggedIn && databaseInterface->userSessionExists(name))
+            qDebug() << "Active session and sessions table inconsistent, please validate session table information "
+                        "for user "
+                     << name;
 
     } else if (authState == UnknownUser) {
         // Change user name so that no two users have the same names,
         // don't interfere with registered user names though.
         if (getRegOnlyServerEnabled()) {
             qDebug("Login denied: registration required");
-            databaseInterface->unlockSessionTables();
             return RegistrationRequired;
         }
 
         QString tempName = name;
         int i = 0;
-        while (users.contains(tempName) || databaseInterface->activeUserExists(tempName) ||
-               databaseInterface->userSessionExists(tempName))
+        forever {
+            while (databaseInterface->activeUserExists(tempName) || databaseInterface->userSessionExists(tempName))
+                tempName = name + "_" + QString::number(++i);
+
+            QWriteLocker locker(&clientsLock);
+            if (!users.contains(tempName) && !reservedUserNames.contains(tempName)) {
+                reservedUserNames.insert(tempName);
+                break;
+            }
             tempName = name + "_" + QString::number(++i);
+        }
         name = tempName;
         data.set_name(name.toStdString());
     }
 
+    // The session row is a plain insert; users (under clientsLock) is what keeps names unique on this server,
+    // so there is no need to lock the sessions table or to hold clientsLock during the database round trip.
+    qint64 sessionId =
+        databaseInterface->startSession(name, session->getAddress(), clientid, session->getConnectionType());
+
     QWriteLocker locker(&clientsLock);
-    databaseInterface->lockSessionTables();
+    reservedUserNames.remove(name);
+    Server_ProtocolHandler *oldSession = users.value(name);
+    if (oldSession && oldSession != session) {
+        qDebug("Session already logged in, logging old session out");
+        Event_ConnectionClosed event;
+        event.set_reason(Event_ConnectionClosed::LOGGEDINELSEWERE);
+        event.set_reason_str("You have been logged out due to logging in at another location.");
+        event.set_end_time(QDateTime::currentDateTime().toTime_t());
+
+        SessionEvent *se = oldSession->prepareSessionEvent(event);
+        oldSession->sendProtocolItem(*se);
+        delete se;
+
+        // prepareDestroy() takes roomsLock and clientsLock itself, let the session's own thread run it. It
+        // leaves alone the players that the new session has taken over meanwhile.
+        QMetaObject::invokeMethod(oldSession, "prepareDestroy", Qt::QueuedConnection);
+    }
     users.insert(name, session);
     qDebug() << "Server::loginUser:" << session << "name=" << name;
 
-    data.set_session_id(static_cast<google::protobuf::uint64>(
-        databaseInterface->startSession(name, session->getAddress(), clientid, session->getConnectionType())));
-    databaseInterface->unlockSessionTables();
-
+    data.set_session_id(static_cast<google::protobuf::uint64>(sessionId));
     usersBySessionId.insert(data.session_id(), session);
 
     qDebug() << "session id:" << data.session_id();
@@ -156,9 +182,10 @@ AuthenticationResult Server::loginUser(Server_ProtocolHandler *session,
     Event_UserJoined event;
     event.mutable_user_info()->CopyFrom(session->copyUserInfo(false));
     SessionEvent *se = Server_ProtocolHandler::prepareSessionEvent(event);
+    const QByteArray serializedEvent = Server_ProtocolHandler::serializeProtocolItem(*se);
     for (auto &client : clients)
         if (client->getAcceptsUserListChanges())
-            client->sendProtocolItem(*se);
+            client->sendSerializedProtocolItem(serializedEvent);
     delete se;
 
     event.mutable_user_info()->CopyFrom(session->copyUserInfo(true, true, true));
@@ -199,6 +226,47 @@ QList<PlayerReference> Server::getPersistentPlayerReferences(const QString &user
     return persistentPlayers.values(userName);
 }
 
+void Server::addGameUser(const QString &userName, int roomId, int gameId, int playerId)
+{
+    QWriteLocker locker(&gameIndexLock);
+    gameUsers.insert(userName, PlayerReference(roomId, gameId, playerId));
+}
+
+void Server::removeGameUser(const QString &userName, int roomId, int gameId, int playerId)
+{
+    QWriteLocker locker(&gameIndexLock);
+    gameUsers.remove(userName, PlayerReference(roomId, gameId, playerId));
+}
+
+QList<PlayerReference> Server::getGameUserReferences(const QString &userName) const
+{
+    QReadLocker locker(&gameIndexLock);
+    return gameUsers.values(userName);
+}
+
+void Server::addGameCreator(const QString &userName, int roomId, int gameId)
+{
+    QWriteLocker locker(&gameIndexLock);
+    gameCreators.insert(userName, PlayerReference(roomId, gameId, -1));
+}
+
+void Server::removeGameCreator(const QString &userName, int roomId, int gameId)
+{
+    QWriteLocker locker(&gameIndexLock);
+    gameCreators.remove(userName, PlayerReference(roomId, gameId, -1));
+}
+
+int Server::getGamesCreatedByUser(const QString &userName, int roomId) const
+{
+    QReadLocker locker(&gameIndexLock);
+    int result = 0;
+    for (auto game = gameCreators.constFind(userName); game != gameCreators.constEnd() && game.key() == userName;
+         ++game)
+        if (game.value().getRoomId() == roomId)
+            ++result;
+    return result;
+}
+
 Server_AbstractUserInterface *Server::findUser(const QString &userName) const
 {
     // Call this only with clientsLock set.
@@ -219,6 +287,7 @@ void Server::addClient(Server_ProtocolHandler *client)
         webSocketUserCount++;
 
     QWriteLocker locker(&clientsLock);
+    clientIndexes.insert(client, clients.size());
     clients << client;
 }
 
@@ -232,20 +301,31 @@ void Server::removeClient(Server_ProtocolHandler *client)
         webSocketUserCount--;
 
     QWriteLocker locker(&clientsLock);
-    clients.removeAt(clients.indexOf(client));
+    // move the last client into the gap instead of shifting everything behind it
+    const int index = clientIndexes.take(client);
+    Server_ProtocolHandler *lastClient = clients.takeLast();
+    if (lastClient != client) {
+        clients[index] = lastClient;
+        clientIndexes.insert(lastClient, index);
+    }
     ServerInfo_User *data = client->getUserInfo();
     if (data) {
-        Event_UserLeft event;
-        event.set_name(data->name());
-        SessionEvent *se = Server_ProtocolHandler::prepareSessionEvent(event);
-        for (auto &client : clients)
-            if (client->getAcceptsUserListChanges())
-                client->sendProtocolItem(*se);
-        sendIsl_SessionEvent(*se);
-        delete se;
-
-        users.remove(QString::fromStdString(data->name()));
-        qDebug() << "Server::removeClient: name=" << QString::fromStdString(data->name());
+        // the name may already belong to a newer session that logged this one out, that user stays online
+        const QString name = QString::fromStdString(data->name());
+        if (users.value(name) == client) {
+            Event_UserLeft event;
+            event.set_name(data->name());
+            SessionEvent *se = Server_ProtocolHandler::prepareSessionEvent(event);
+            const QByteArray serializedEvent = Server_ProtocolHandler::serializeProtocolItem(*se);
+            for (auto &client : clients)
+                if (client->getAcceptsUserListChanges())
+                    client->sendSerializedProtocolItem(serializedEvent);
+            sendIsl_SessionEvent(*se);
+            delete se;
+
+            users.remove(name);
+        }
+        qDebug() << "Server::removeClient: name=" << name;
 
         if (data->has_session_id()) {
             const qint64 sessionId = data->session_id();
@@ -523,21 +603,75 @@ void Server::broadcastRoomUpdate(const ServerInfo_Room &roomInfo, bool sendToIsl
 {
     // This function is always called from the main thread via signal/slot.
 
-    Event_ListRooms event;
-    event.add_room_list()->CopyFrom(roomInfo);
+    pendingRoomUpdates[roomInfo.room_id()].MergeFrom(roomInfo);
+    pendingRoomUpdatesToIsl |= sendToIsl;
+
+    const int interval = getRoomUpdateInterval();
+    if (interval <= 0)
+        flushRoomUpdates();
+    else if (!roomUpdateTimer->isActive())
+        roomUpdateTimer->start(interval);
+}
+
+void Server::flushRoomUpdates()
+{
+    // Rooms only report their player and game counts here. Counts that are back to the value last broadcast
+    // are left out, unless a client has read the room list meanwhile: it may have seen an intermediate value.
+    const int currentRoomListGeneration = roomListGeneration.loadAcquire();
+    const bool sendUnchanged = currentRoomListGeneration != flushedRoomListGeneration;
+    flushedRoomListGeneration = currentRoomListGeneration;
+
+    QList<ServerInfo_Room> deltas;
+    QMapIterator<int, ServerInfo_Room> updateIterator(pendingRoomUpdates);
+    while (updateIterator.hasNext()) {
+        const ServerInfo_Room &update = updateIterator.next().value();
+        ServerInfo_Room &broadcast = broadcastRoomCounts[updateIterator.key()];
+
+        ServerInfo_Room delta;
+        delta.set_room_id(updateIterator.key());
+        if (update.has_player_count() &&
+            (sendUnchanged || !broadcast.has_player_count() || broadcast.player_count() != update.player_count()))
+            delta.set_player_count(update.player_count());
+        if (update.has_game_count() &&
+            (sendUnchanged || !broadcast.has_game_count() || broadcast.game_count() != update.game_count()))
+            delta.set_game_count(update.game_count());
+
+        if (delta.has_player_count() || delta.has_game_count()) {
+            broadcast.MergeFrom(delta);
+            deltas.append(delta);
+        }
+    }
+    pendingRoomUpdates.clear();
+    const bool sendToIsl = pendingRoomUpdatesToIsl;
+    pendingRoomUpdatesToIsl = false;
 
-    SessionEvent *se = Server_ProtocolHandler::prepareSessionEvent(event);
+    if (deltas.isEmpty())
+        return;
+
+    // One event per room: older clients stop reading an Event_ListRooms after the first room they know.
+    // Every event is still serialized once and shared by all clients.
+    QList<SessionEvent *> events;
+    QList<QByteArray> serializedEvents;
+    for (const ServerInfo_Room &delta : deltas) {
+        Event_ListRooms event;
+        event.add_room_list()->CopyFrom(delta);
+        SessionEvent *se = Server_ProtocolHandler::prepareSessionEvent(event);
+        events.append(se);
+        serializedEvents.append(Server_ProtocolHandler::serializeProtocolItem(*se));
+    }
 
     clientsLock.lockForRead();
     for (auto &client : clients)
         if (client->getAcceptsRoomListChanges())
-            client->sendProtocolItem(*se);
+            for (const QByteArray &serializedEvent : serializedEvents)
+                client->sendSerializedProtocolItem(serializedEvent);
     clientsLock.unlock();
 
-    if (sendToIsl)
-        sendIsl_SessionEvent(*se);
-
-    delete se;
+    for (SessionEvent *se : events) {
+        if (sendToIsl)
+            sendIsl_SessionEvent(*se);
+        delete se;
+    }
 }
 
 void Server::addRoom(Server_Room *newRoom)
@@ -4,15 +4,20 @@
 #include "pb/commands.pb.h"
 #include "pb/serverinfo_ban.pb.h"
 #include "pb/serverinfo_chat_message.pb.h"
+#include "pb/serverinfo_room.pb.h"
 #include "pb/serverinfo_user.pb.h"
 #include "pb/serverinfo_warning.pb.h"
 #include "server_player_reference.h"
 
+#include <QAtomicInt>
+#include <QHash>
 #include <QMap>
+#include <QMultiHash>
 #include <QMultiMap>
 #include <QMutex>
 #include <QObject>
 #include <QReadWriteLock>
+#include <QSet>
 #include <QStringList>
 
 class Server_DatabaseInterface;
@@ -20,13 +25,12 @@ class Server_Game;
 class Server_Room;
 class Server_ProtocolHandler;
 class Server_AbstractUserInterface;
-class GameReplay;
 class IslMessage;
 class SessionEvent;
 class RoomEvent;
 class DeckList;
 class ServerInfo_Game;
-class ServerInfo_Room;
+class QTimer;
 class Response;
 class GameEventContainer;
 class CommandContainer;
@@ -49,11 +53,11 @@ class Server : public QObject
 {
     Q_OBJECT
 signals:
-    void pingClockTimeout();
     void sigSendIslMessage(const IslMessage &message, int serverId);
     void endSession(qint64 sessionId);
 private slots:
     void broadcastRoomUpdate(const ServerInfo_Room &roomInfo, bool sendToIsl = false);
+    void flushRoomUpdates();
 
 public:
     mutable QReadWriteLock clientsLock, roomsLock; // locking order: roomsLock before clientsLock
@@ -62,6 +66,7 @@ public:
     AuthenticationResult loginUser(Server_ProtocolHandler *session,
                                    QString &name,
                                    const QString &password,
+                                   const QString &passwordHash,
                                    QString &reason,
                                    int &secondsLeft,
                                    QString &clientid,
@@ -87,7 +92,7 @@ public:
         return QMap<QString, bool>();
     }
     void addClient(Server_ProtocolHandler *player);
-    void removeClient(Server_ProtocolHandler *player);
+    virtual void removeClient(Server_ProtocolHandler *player);
     QList<QString> getOnlineModeratorList() const;
     virtual QString getLoginMessage() const
     {
@@ -177,6 +182,26 @@ public:
     {
         return false;
     }
+    // 0 = games use the shared per-thread random streams, otherwise each game gets its own stream seeded from this
+    virtual quint32 getGameRngSeed() const
+    {
+        return 0;
+    }
+    // Room player and game count changes within this many milliseconds are sent as one event; 0 sends them at once
+    virtual int getRoomUpdateInterval() const
+    {
+        return 0;
+    }
+    // Game list changes of a room within this many milliseconds are sent as one event; 0 sends them at once
+    virtual int getGameListUpdateInterval() const
+    {
+        return 0;
+    }
+    // Directory for the spool files of running games' replays; empty keeps replays in memory
+    virtual QString getReplaySpoolPath() const
+    {
+        return QString();
+    }
 
     Server_DatabaseInterface *getDatabaseInterface() const;
     int getNextLocalGameId()
@@ -200,8 +225,21 @@ public:
     void addPersistentPlayer(const QString &userName, int roomId, int gameId, int playerId);
     void removePersistentPlayer(const QString &userName, int roomId, int gameId, int playerId);
     QList<PlayerReference> getPersistentPlayerReferences(const QString &userName) const;
+
+    // Every game a user plays or spectates in, and the games a user has created, across all rooms
+    void addGameUser(const QString &userName, int roomId, int gameId, int playerId);
+    void removeGameUser(const QString &userName, int roomId, int gameId, int playerId);
+    QList<PlayerReference> getGameUserReferences(const QString &userName) const;
+    void addGameCreator(const QString &userName, int roomId, int gameId);
+    void removeGameCreator(const QString &userName, int roomId, int gameId);
+    int getGamesCreatedByUser(const QString &userName, int roomId) const;
     int getUsersCount() const;
     int getGamesCount() const;
+    // Called by clients after reading the room list, see flushRoomUpdates()
+    void roomListSent()
+    {
+        roomListGeneration.fetchAndAddRelaxed(1);
+    }
     int getTCPUserCount() const
     {
         return tcpUserCount;
@@ -214,9 +252,18 @@ public:
 private:
     QMultiMap<QString, PlayerReference> persistentPlayers;
     mutable QReadWriteLock persistentPlayersLock;
+    QMultiHash<QString, PlayerReference> gameUsers, gameCreators; // creators have player id -1
+    mutable QReadWriteLock gameIndexLock;
     int nextLocalGameId, tcpUserCount, webSocketUserCount;
     QMutex nextLocalGameIdMutex;
 
+    // Room updates waiting for roomUpdateTimer and the counts last broadcast; only used in the main thread
+    QTimer *roomUpdateTimer;
+    QMap<int, ServerInfo_Room> pendingRoomUpdates, broadcastRoomCounts;
+    bool pendingRoomUpdatesToIsl;
+    QAtomicInt roomListGeneration;
+    int flushedRoomListGeneration;
+
 protected slots:
     void externalUserJoined(const ServerInfo_User &userInfo);
     void externalUserLeft(const QString &userName);
@@ -238,9 +285,11 @@ protected slots:
 protected:
     void prepareDestroy();
     void setDatabaseInterface(Server_DatabaseInterface *_databaseInterface);
-    QList<Server_ProtocolHandler *> clients;
+    QList<Server_ProtocolHandler *> clients; // unordered
+    QHash<Server_ProtocolHandler *, int> clientIndexes;
     QMap<qint64, Server_ProtocolHandler *> usersBySessionId;
     QMap<QString, Server_ProtocolHandler *> users;
+    QSet<QString> reservedUserNames; // guest names claimed by logins that are still starting their session
     QMap<qint64, Server_AbstractUserInterface *> externalUsersBySessionId;
     QMap<QString, Server_AbstractUserInterface *> externalUsers;
     QMap<int, Server_Room *> rooms;
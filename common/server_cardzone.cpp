@@ -22,6 +22,7 @@
 #include "pb/command_move_card.pb.h"
 #include "rng_abstract.h"
 #include "server_card.h"
+#include "server_game.h"
 #include "server_player.h"
 
 #include <QDebug>
@@ -59,8 +60,9 @@ void Server_CardZone::shuffle(int start, int end)
     if (start < 0 || end < 0 || start >= cards.size() || end >= cards.size())
         return;
 
+    RNG_Abstract *gameRng = player->getGame()->getRng();
     for (int i = end; i > start; i--) {
-        int j = rng->rand(start, i);
+        int j = gameRng->rand(start, i);
 #if (QT_VERSION >= QT_VERSION_CHECK(5, 13, 0))
         cards.swapItemsAt(j, i);
 #else
@@ -2,6 +2,7 @@
 #define SERVER_DATABASE_INTERFACE_H
 
 #include "server.h"
+#include "server_replaywriter.h"
 
 #include <QObject>
 
@@ -16,6 +17,7 @@ public:
     virtual AuthenticationResult checkUserPassword(Server_ProtocolHandler *handler,
                                                    const QString &user,
                                                    const QString &password,
+                                                   const QString &passwordHash, // empty if not computed yet
                                                    const QString &clientId,
                                                    QString &reasonStr,
                                                    int &secondsLeft) = 0;
@@ -57,8 +59,10 @@ public:
                                       const ServerInfo_Game & /* gameInfo */,
                                       const QSet<QString> & /* allPlayersEver */,
                                       const QSet<QString> & /* allSpectatorsEver */,
-                                      const QList<GameReplay *> & /* replayList */)
+                                      const QList<Server_ReplayWriter *> &replayList)
     {
+        // takes ownership of the finished replays
+        qDeleteAll(replayList);
     }
     virtual DeckList *getDeckFromDatabase(int /* deckId */, int /* userId */)
     {
@@ -92,12 +96,6 @@ public:
     virtual void clearSessionTables()
     {
     }
-    virtual void lockSessionTables()
-    {
-    }
-    virtual void unlockSessionTables()
-    {
-    }
     virtual bool userSessionExists(const QString & /* userName */)
     {
         return false;
@@ -110,7 +108,7 @@ public:
     virtual bool registerUser(const QString & /* userName */,
                               const QString & /* realName */,
                               ServerInfo_User_Gender const & /* gender */,
-                              const QString & /* password */,
+                              const QString & /* passwordSha512 */,
                               const QString & /* emailAddress */,
                               const QString & /* country */,
                               bool /* active = false */)
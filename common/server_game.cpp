@@ -34,8 +34,8 @@
 #include "pb/event_replay_added.pb.h"
 #include "pb/event_set_active_phase.pb.h"
 #include "pb/event_set_active_player.pb.h"
-#include "pb/game_replay.pb.h"
 #include "pb/serverinfo_playerping.pb.h"
+#include "rng_sfmt.h"
 #include "server.h"
 #include "server_arrow.h"
 #include "server_card.h"
@@ -43,10 +43,10 @@
 #include "server_database_interface.h"
 #include "server_player.h"
 #include "server_protocolhandler.h"
+#include "server_replaywriter.h"
 #include "server_room.h"
 
 #include <QDebug>
-#include <QTimer>
 #include <google/protobuf/descriptor.h>
 
 Server_Game::Server_Game(const ServerInfo_User &_creatorInfo,
@@ -71,31 +71,47 @@ Server_Game::Server_Game(const ServerInfo_User &_creatorInfo,
       secondsElapsed(0), firstGameStarted(false), turnOrderReversed(false), startTime(QDateTime::currentDateTime()),
       gameMutex(QMutex::Recursive)
 {
-    currentReplay = new GameReplay;
-    currentReplay->set_replay_id(room->getServer()->getDatabaseInterface()->getNextReplayId());
+    const quint32 rngSeed = room->getServer()->getGameRngSeed();
+    if (rngSeed != 0) {
+        // reproducible games: the same seed and game id always produce the same random numbers
+        gameRng = new RNG_SFMT_Seeded(rngSeed, static_cast<quint32>(gameId), this);
+    } else
+        gameRng = rng;
+
+    const quint64 replayId = room->getServer()->getDatabaseInterface()->getNextReplayId();
     description = _description.simplified();
 
     connect(this, SIGNAL(sigStartGameIfReady()), this, SLOT(doStartGameIfReady()), Qt::QueuedConnection);
 
-    getInfo(*currentReplay->mutable_game_info());
+    ServerInfo_Game replayGameInfo;
+    getInfo(replayGameInfo);
+    currentReplay = new Server_ReplayWriter(replayId, replayGameInfo, room->getServer()->getReplaySpoolPath());
 
     if (room->getServer()->getGameShouldPing()) {
-        pingClock = new QTimer(this);
-        connect(pingClock, SIGNAL(timeout()), this, SLOT(pingClockTimeout()));
-        pingClock->start(1000);
+        pingWheel = Server_TimerWheel::forCurrentThread();
+        pingWheel->schedule(this, 1);
     }
 }
 
 Server_Game::~Server_Game()
 {
+    // games left over at shutdown are deleted by the main thread, not by the thread of their wheel
+    if (pingWheel)
+        pingWheel->unscheduleFromAnyThread(this);
+
     room->gamesLock.lockForWrite();
     gameMutex.lock();
 
     gameClosed = true;
     sendGameEventContainer(prepareGameEvent(Event_GameClosed(), -1));
+    Server *server = room->getServer();
     QMapIterator<int, Server_Player *> playerIterator(players);
-    while (playerIterator.hasNext())
-        playerIterator.next().value()->prepareDestroy();
+    while (playerIterator.hasNext()) {
+        Server_Player *player = playerIterator.next().value();
+        server->removeGameUser(QString::fromStdString(player->getUserInfo()->name()), room->getId(), gameId,
+                               player->getPlayerId());
+        player->prepareDestroy();
+    }
     players.clear();
 
     room->removeGame(this);
@@ -104,19 +120,16 @@ Server_Game::~Server_Game()
 
     gameMutex.unlock();
     room->gamesLock.unlock();
-    currentReplay->set_duration_seconds(secondsElapsed - startTimeOfThisGame);
+    currentReplay->finish(secondsElapsed - startTimeOfThisGame);
     replayList.append(currentReplay);
     storeGameInformation();
 
-    for (int i = 0; i < replayList.size(); ++i)
-        delete replayList[i];
-
     qDebug() << "Server_Game destructor: gameId=" << gameId;
 }
 
 void Server_Game::storeGameInformation()
 {
-    const ServerInfo_Game &gameInfo = replayList.first()->game_info();
+    const ServerInfo_Game &gameInfo = replayList.first()->getGameInfo();
 
     Event_ReplayAdded replayEvent;
     ServerInfo_ReplayMatch *replayMatchInfo = replayEvent.mutable_match_info();
@@ -137,9 +150,9 @@ void Server_Game::storeGameInformation()
 
     for (int i = 0; i < replayList.size(); ++i) {
         ServerInfo_Replay *replayInfo = replayMatchInfo->add_replay_list();
-        replayInfo->set_replay_id(replayList[i]->replay_id());
+        replayInfo->set_replay_id(replayList[i]->getReplayId());
         replayInfo->set_replay_name(gameInfo.description());
-        replayInfo->set_duration(replayList[i]->duration_seconds());
+        replayInfo->set_duration(replayList[i]->getDurationSeconds());
     }
 
     QSet<QString> allUsersInGame = allPlayersEver + allSpectatorsEver;
@@ -156,12 +169,16 @@ void Server_Game::storeGameInformation()
     server->clientsLock.unlock();
     delete sessionEvent;
 
+    // the database interface takes ownership of the replays
     if (server->getStoreReplaysEnabled())
         server->getDatabaseInterface()->storeGameInformation(room->getName(), gameTypes, gameInfo, allPlayersEver,
                                                              allSpectatorsEver, replayList);
+    else
+        qDeleteAll(replayList);
+    replayList.clear();
 }
 
-void Server_Game::pingClockTimeout()
+void Server_Game::timerWheelTick()
 {
     QMutexLocker locker(&gameMutex);
     ++secondsElapsed;
@@ -264,7 +281,7 @@ void Server_Game::sendGameStateToPlayers()
     GameEventContainer *replayCont = prepareGameEvent(omniscientEvent, -1);
     replayCont->set_seconds_elapsed(secondsElapsed - startTimeOfThisGame);
     replayCont->clear_game_id();
-    currentReplay->add_event_list()->CopyFrom(*replayCont);
+    currentReplay->appendEvent(*replayCont);
     delete replayCont;
 
     // If spectators are not omniscient, we need an additional createGameStateChangedEvent call, otherwise we can use
@@ -323,13 +340,13 @@ void Server_Game::doStartGameIfReady()
     }
 
     if (firstGameStarted) {
-        currentReplay->set_duration_seconds(secondsElapsed - startTimeOfThisGame);
+        currentReplay->finish(secondsElapsed - startTimeOfThisGame);
         replayList.append(currentReplay);
-        currentReplay = new GameReplay;
-        currentReplay->set_replay_id(databaseInterface->getNextReplayId());
-        ServerInfo_Game *gameInfo = currentReplay->mutable_game_info();
-        getInfo(*gameInfo);
-        gameInfo->set_started(false);
+        ServerInfo_Game gameInfo;
+        getInfo(gameInfo);
+        gameInfo.set_started(false);
+        currentReplay = new Server_ReplayWriter(databaseInterface->getNextReplayId(), gameInfo,
+                                                room->getServer()->getReplaySpoolPath());
 
         Event_GameStateChanged omniscientEvent;
         createGameStateChangedEvent(&omniscientEvent, 0, true, true);
@@ -337,7 +354,7 @@ void Server_Game::doStartGameIfReady()
         GameEventContainer *replayCont = prepareGameEvent(omniscientEvent, -1);
         replayCont->set_seconds_elapsed(0);
         replayCont->clear_game_id();
-        currentReplay->add_event_list()->CopyFrom(*replayCont);
+        currentReplay->appendEvent(*replayCont);
         delete replayCont;
 
         startTimeOfThisGame = secondsElapsed;
@@ -471,6 +488,7 @@ void Server_Game::addPlayer(Server_AbstractUserInterface *userInterface,
     else
         allPlayersEver.insert(playerName);
     players.insert(newPlayer->getPlayerId(), newPlayer);
+    room->getServer()->addGameUser(playerName, room->getId(), gameId, newPlayer->getPlayerId());
     if (newPlayer->getUserInfo()->name() == creatorInfo->name()) {
         hostId = newPlayer->getPlayerId();
         sendGameEventContainer(prepareGameEvent(Event_GameHostChanged(), hostId));
@@ -497,6 +515,8 @@ void Server_Game::removePlayer(Server_Player *player, Event_Leave::LeaveReason r
 {
     room->getServer()->removePersistentPlayer(QString::fromStdString(player->getUserInfo()->name()), room->getId(),
                                               gameId, player->getPlayerId());
+    room->getServer()->removeGameUser(QString::fromStdString(player->getUserInfo()->name()), room->getId(), gameId,
+                                      player->getPlayerId());
     players.remove(player->getPlayerId());
 
     GameEventStorage ges;
@@ -732,7 +752,7 @@ void Server_Game::sendGameEventContainer(GameEventContainer *cont,
     if (recipients.testFlag(GameEventStorageItem::SendToPrivate)) {
         cont->set_seconds_elapsed(secondsElapsed - startTimeOfThisGame);
         cont->clear_game_id();
-        currentReplay->add_event_list()->CopyFrom(*cont);
+        currentReplay->appendEvent(*cont);
     }
 
     delete cont;
@@ -24,17 +24,19 @@
 #include "pb/response.pb.h"
 #include "pb/serverinfo_game.pb.h"
 #include "server_response_containers.h"
+#include "server_timerwheel.h"
 
 #include <QDateTime>
 #include <QMap>
 #include <QMutex>
 #include <QObject>
+#include <QPointer>
 #include <QSet>
 #include <QStringList>
 
-class QTimer;
 class GameEventContainer;
-class GameReplay;
+class RNG_Abstract;
+class Server_ReplayWriter;
 class Server_Room;
 class Server_Player;
 class ServerInfo_User;
@@ -43,7 +45,7 @@ class ServerInfo_Game;
 class Server_AbstractUserInterface;
 class Event_GameStateChanged;
 
-class Server_Game : public QObject
+class Server_Game : public QObject, public Server_TimerWheelClient
 {
     Q_OBJECT
 private:
@@ -71,20 +73,21 @@ private:
     bool firstGameStarted;
     bool turnOrderReversed;
     QDateTime startTime;
-    QTimer *pingClock;
-    QList<GameReplay *> replayList;
-    GameReplay *currentReplay;
+    QPointer<Server_TimerWheel> pingWheel;
+    RNG_Abstract *gameRng;
+    QList<Server_ReplayWriter *> replayList;
+    Server_ReplayWriter *currentReplay;
 
     void createGameStateChangedEvent(Event_GameStateChanged *event,
                                      Server_Player *playerWhosAsking,
                                      bool omniscient,
                                      bool withUserInfo);
     void storeGameInformation();
+    void timerWheelTick();
 signals:
     void sigStartGameIfReady();
     void gameInfoChanged(ServerInfo_Game gameInfo);
 private slots:
-    void pingClockTimeout();
     void doStartGameIfReady();
 
 public:
@@ -130,6 +133,11 @@ public:
     {
         return gameId;
     }
+    // Source of all random numbers of this game (shuffles, die rolls, random reveals)
+    RNG_Abstract *getRng() const
+    {
+        return gameRng;
+    }
     QString getDescription() const
     {
         return description;
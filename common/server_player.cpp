@@ -1046,7 +1046,7 @@ Server_Player::cmdRollDie(const Command_RollDie &cmd, ResponseContainer & /*rc*/
 
     Event_RollDie event;
     event.set_sides(cmd.sides());
-    event.set_value(rng->rand(1, cmd.sides()));
+    event.set_value(game->getRng()->rand(1, cmd.sides()));
     ges.enqueueGameEvent(event, playerId);
 
     return Response::RespOk;
@@ -1897,7 +1897,7 @@ Server_Player::cmdRevealCards(const Command_RevealCards &cmd, ResponseContainer
         if (zone->getCards().isEmpty()) {
             return Response::RespContextError;
         }
-        cardsToReveal.append(zone->getCards().at(rng->rand(0, zone->getCards().size() - 1)));
+        cardsToReveal.append(zone->getCards().at(game->getRng()->rand(0, zone->getCards().size() - 1)));
     } else {
         Server_Card *card = zone->getCard(cmd.card_id());
         if (!card) {
@@ -34,11 +34,24 @@ Server_ProtocolHandler::Server_ProtocolHandler(Server *_server,
       idleClientWarningSent(false), timeRunning(0), lastDataReceived(0), lastActionReceived(0)
 
 {
-    connect(server, SIGNAL(pingClockTimeout()), this, SLOT(pingClockTimeout()));
+    // Queued so that the clock is started in the thread the handler is eventually moved to
+    QMetaObject::invokeMethod(this, "startPingClock", Qt::QueuedConnection);
 }
 
 Server_ProtocolHandler::~Server_ProtocolHandler()
 {
+    if (pingWheel)
+        pingWheel->unscheduleFromAnyThread(this);
+}
+
+void Server_ProtocolHandler::startPingClock()
+{
+    const int keepAlive = server->getClientKeepAlive();
+    if (keepAlive <= 0)
+        return;
+
+    pingWheel = Server_TimerWheel::forCurrentThread();
+    pingWheel->schedule(this, keepAlive);
 }
 
 // This function must only be called from the thread this object lives in.
@@ -77,7 +90,10 @@ void Server_ProtocolHandler::prepareDestroy()
             continue;
         }
 
-        p->disconnectClient();
+        // A session logged out by a new login of the same user runs this later, queued from Server::loginUser;
+        // by then joinPersistentGames() may have attached the player to the new session, which keeps it.
+        if (p->getUserInterface() == this)
+            p->disconnectClient();
 
         g->gameMutex.unlock();
         r->gamesLock.unlock();
@@ -125,6 +141,49 @@ void Server_ProtocolHandler::sendProtocolItem(const RoomEvent &item)
     transmitProtocolItem(msg);
 }
 
+static QByteArray serializeServerMessage(const ServerMessage &msg)
+{
+    QByteArray result;
+#if GOOGLE_PROTOBUF_VERSION > 3001000
+    result.resize(static_cast<int>(msg.ByteSizeLong()));
+#else
+    result.resize(msg.ByteSize());
+#endif
+    msg.SerializeToArray(result.data(), result.size());
+    return result;
+}
+
+QByteArray Server_ProtocolHandler::serializeProtocolItem(const SessionEvent &item)
+{
+    ServerMessage msg;
+    msg.mutable_session_event()->CopyFrom(item);
+    msg.set_message_type(ServerMessage::SESSION_EVENT);
+
+    return serializeServerMessage(msg);
+}
+
+QByteArray Server_ProtocolHandler::serializeProtocolItem(const RoomEvent &item)
+{
+    ServerMessage msg;
+    msg.mutable_room_event()->CopyFrom(item);
+    msg.set_message_type(ServerMessage::ROOM_EVENT);
+
+    return serializeServerMessage(msg);
+}
+
+void Server_ProtocolHandler::sendSerializedProtocolItem(const QByteArray &item)
+{
+    transmitSerializedProtocolItem(item);
+}
+
+void Server_ProtocolHandler::transmitSerializedProtocolItem(const QByteArray &item)
+{
+    // Fallback for handlers that deliver ServerMessage objects rather than bytes (e.g. local games)
+    ServerMessage msg;
+    msg.ParseFromArray(item.constData(), item.size());
+    transmitProtocolItem(msg);
+}
+
 Response::ResponseCode Server_ProtocolHandler::processSessionCommandContainer(const CommandContainer &cont,
                                                                               ResponseContainer &rc)
 {
@@ -133,7 +192,8 @@ Response::ResponseCode Server_ProtocolHandler::processSessionCommandContainer(co
         Response::ResponseCode resp = Response::RespInvalidCommand;
         const SessionCommand &sc = cont.session_command(i);
         const int num = getPbExtension(sc);
-        if (num != SessionCommand::PING) {      // don't log ping commands
+        // don't log ping commands
+        if (num != SessionCommand::PING && isCommandLogged(SessionCommandLog, num)) {
             if (num == SessionCommand::LOGIN) { // log login commands, but hide passwords
                 SessionCommand debugSc(sc);
                 debugSc.MutableExtension(Command_Login::ext)->clear_password();
@@ -197,7 +257,8 @@ Response::ResponseCode Server_ProtocolHandler::processRoomCommandContainer(const
         Response::ResponseCode resp = Response::RespInvalidCommand;
         const RoomCommand &sc = cont.room_command(i);
         const int num = getPbExtension(sc);
-        logDebugMessage(QString::fromStdString(sc.ShortDebugString()));
+        if (isCommandLogged(RoomCommandLog, num))
+            logDebugMessage(QString::fromStdString(sc.ShortDebugString()));
         switch ((RoomCommand::RoomCommandType)num) {
             case RoomCommand::LEAVE_ROOM:
                 resp = cmdLeaveRoom(sc.GetExtension(Command_LeaveRoom::ext), room, rc);
@@ -275,15 +336,17 @@ Response::ResponseCode Server_ProtocolHandler::processGameCommandContainer(const
     Response::ResponseCode finalResponseCode = Response::RespOk;
     for (int i = cont.game_command_size() - 1; i >= 0; --i) {
         const GameCommand &sc = cont.game_command(i);
-        logDebugMessage(QString("game %1 player %2: ").arg(cont.game_id()).arg(roomIdAndPlayerId.second) +
-                        QString::fromStdString(sc.ShortDebugString()));
+        const int num = getPbExtension(sc);
+        if (isCommandLogged(GameCommandLog, num))
+            logDebugMessage(QString("game %1 player %2: ").arg(cont.game_id()).arg(roomIdAndPlayerId.second) +
+                            QString::fromStdString(sc.ShortDebugString()));
 
         if (commandCountingInterval > 0) {
             int totalCount = 0;
             if (commandCountOverTime.isEmpty())
                 commandCountOverTime.prepend(0);
 
-            if (!antifloodCommandsWhiteList.contains((GameCommand::GameCommandType)getPbExtension(sc)))
+            if (!antifloodCommandsWhiteList.contains((GameCommand::GameCommandType)num))
                 ++commandCountOverTime[0];
 
             for (int i = 0; i < commandCountOverTime.size(); ++i)
@@ -318,7 +381,8 @@ Response::ResponseCode Server_ProtocolHandler::processModeratorCommandContainer(
         Response::ResponseCode resp = Response::RespInvalidCommand;
         const ModeratorCommand &sc = cont.moderator_command(i);
         const int num = getPbExtension(sc);
-        logDebugMessage(QString::fromStdString(sc.ShortDebugString()));
+        if (isCommandLogged(ModeratorCommandLog, num))
+            logDebugMessage(QString::fromStdString(sc.ShortDebugString()));
 
         resp = processExtendedModeratorCommand(num, sc, rc);
         if (resp != Response::RespOk)
@@ -342,7 +406,8 @@ Response::ResponseCode Server_ProtocolHandler::processAdminCommandContainer(cons
         Response::ResponseCode resp = Response::RespInvalidCommand;
         const AdminCommand &sc = cont.admin_command(i);
         const int num = getPbExtension(sc);
-        logDebugMessage(QString::fromStdString(sc.ShortDebugString()));
+        if (isCommandLogged(AdminCommandLog, num))
+            logDebugMessage(QString::fromStdString(sc.ShortDebugString()));
 
         resp = processExtendedAdminCommand(num, sc, rc);
         if (resp != Response::RespOk)
@@ -359,6 +424,9 @@ void Server_ProtocolHandler::processCommandContainer(const CommandContainer &con
 
     lastDataReceived = timeRunning;
 
+    if (deferCommandContainer(cont))
+        return;
+
     ResponseContainer responseContainer(cont.has_cmd_id() ? cont.cmd_id() : -1);
     Response::ResponseCode finalResponseCode;
 
@@ -379,7 +447,7 @@ void Server_ProtocolHandler::processCommandContainer(const CommandContainer &con
         sendResponseContainer(responseContainer, finalResponseCode);
 }
 
-void Server_ProtocolHandler::pingClockTimeout()
+void Server_ProtocolHandler::timerWheelTick()
 {
 
     int cmdcountinterval = server->getCommandCountingInterval();
@@ -472,7 +540,8 @@ Response::ResponseCode Server_ProtocolHandler::cmdLogin(const Command_Login &cmd
     QString reasonStr;
     int banSecondsLeft = 0;
     QString connectionType = getConnectionType();
-    AuthenticationResult res = server->loginUser(this, userName, QString::fromStdString(cmd.password()), reasonStr,
+    const QString password = QString::fromStdString(cmd.password());
+    AuthenticationResult res = server->loginUser(this, userName, password, getPreparedPasswordHash(password), reasonStr,
                                                  banSecondsLeft, clientId, clientVersion, connectionType);
     switch (res) {
         case UserIsBanned: {
@@ -628,7 +697,7 @@ Response::ResponseCode Server_ProtocolHandler::cmdGetUserInfo(const Command_GetU
     return Response::RespOk;
 }
 
-Response::ResponseCode Server_ProtocolHandler::cmdListRooms(const Command_ListRooms & /*cmd*/, ResponseContainer &rc)
+Response::ResponseCode Server_ProtocolHandler::cmdListRooms(const Command_ListRooms &cmd, ResponseContainer &rc)
 {
     if (authState == NotLoggedIn)
         return Response::RespLoginNeeded;
@@ -639,7 +708,9 @@ Response::ResponseCode Server_ProtocolHandler::cmdListRooms(const Command_ListRo
         roomIterator.next().value()->getInfo(*event.add_room_list(), false);
     rc.enqueuePreResponseItem(ServerMessage::SESSION_EVENT, prepareSessionEvent(event));
 
-    acceptsRoomListChanges = true;
+    acceptsRoomListChanges = cmd.room_updates();
+    if (acceptsRoomListChanges)
+        server->roomListSent();
     return Response::RespOk;
 }
 
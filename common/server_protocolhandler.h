@@ -5,16 +5,18 @@
 #include "pb/server_message.pb.h"
 #include "server.h"
 #include "server_abstractuserinterface.h"
+#include "server_timerwheel.h"
 
+#include <QByteArray>
 #include <QObject>
 #include <QPair>
+#include <QPointer>
 
 class Features;
 class Server_DatabaseInterface;
 class Server_Player;
 class ServerInfo_User;
 class Server_Room;
-class QTimer;
 class FeatureSet;
 
 class ServerMessage;
@@ -43,7 +45,7 @@ class Command_RoomSay;
 class Command_CreateGame;
 class Command_JoinGame;
 
-class Server_ProtocolHandler : public QObject, public Server_AbstractUserInterface
+class Server_ProtocolHandler : public QObject, public Server_AbstractUserInterface, public Server_TimerWheelClient
 {
     Q_OBJECT
 protected:
@@ -58,13 +60,38 @@ protected:
     virtual void logDebugMessage(const QString & /* message */)
     {
     }
+    enum CommandLogCategory
+    {
+        SessionCommandLog,
+        RoomCommandLog,
+        GameCommandLog,
+        ModeratorCommandLog,
+        AdminCommandLog
+    };
+    // Checked before a command is dumped to the debug log, so no text is built for commands nobody logs
+    virtual bool isCommandLogged(CommandLogCategory /* category */, int /* commandType */)
+    {
+        return false;
+    }
+    // Lets a command container wait for slow work done off this thread (e.g. password hashing); the
+    // implementation calls processCommandContainer() again once it's ready. Returns true if deferred.
+    virtual bool deferCommandContainer(const CommandContainer & /* cont */)
+    {
+        return false;
+    }
+    // The salted hash of password if a deferred command already computed it, otherwise empty
+    virtual QString getPreparedPasswordHash(const QString & /* password */) const
+    {
+        return QString();
+    }
 
 private:
     QList<int> messageSizeOverTime, messageCountOverTime, commandCountOverTime;
     int timeRunning, lastDataReceived, lastActionReceived;
-    QTimer *pingClock;
+    QPointer<Server_TimerWheel> pingWheel;
 
     virtual void transmitProtocolItem(const ServerMessage &item) = 0;
+    virtual void transmitSerializedProtocolItem(const QByteArray &item);
 
     Response::ResponseCode cmdPing(const Command_Ping &cmd, ResponseContainer &rc);
     Response::ResponseCode cmdLogin(const Command_Login &cmd, ResponseContainer &rc);
@@ -101,8 +128,9 @@ private:
     }
 
     void resetIdleTimer();
+    void timerWheelTick();
 private slots:
-    void pingClockTimeout();
+    void startPingClock();
 public slots:
     void prepareDestroy();
 
@@ -135,6 +163,12 @@ public:
     void sendProtocolItem(const SessionEvent &item);
     void sendProtocolItem(const GameEventContainer &item);
     void sendProtocolItem(const RoomEvent &item);
+
+    // Broadcast helpers: serialize a ServerMessage once and hand the same implicitly shared
+    // buffer to every recipient instead of letting each one encode its own copy.
+    static QByteArray serializeProtocolItem(const SessionEvent &item);
+    static QByteArray serializeProtocolItem(const RoomEvent &item);
+    void sendSerializedProtocolItem(const QByteArray &item);
 };
 
 #endif
@@ -0,0 +1,112 @@
+#include "server_replaywriter.h"
+
+#include "pb/game_replay.pb.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+
+Server_ReplayWriter::Server_ReplayWriter(quint64 _replayId, const ServerInfo_Game &_gameInfo, const QString &spoolPath)
+    : replayId(_replayId), gameInfo(_gameInfo), durationSeconds(0), spoolFile(nullptr)
+{
+    if (!spoolPath.isEmpty()) {
+        spoolFile = new QFile(QDir(spoolPath).filePath(QString("replay_%1.spool").arg(replayId)));
+        if (!spoolFile->open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            qDebug() << "Server_ReplayWriter: can't open spool file" << spoolFile->fileName()
+                     << ", keeping replay in memory";
+            delete spoolFile;
+            spoolFile = nullptr;
+        }
+    }
+
+    GameReplay header;
+    header.set_replay_id(replayId);
+    header.mutable_game_info()->CopyFrom(gameInfo);
+    appendMessage(header);
+}
+
+Server_ReplayWriter::~Server_ReplayWriter()
+{
+    if (spoolFile) {
+        spoolFile->remove();
+        delete spoolFile;
+    }
+}
+
+void Server_ReplayWriter::appendMessage(const ::google::protobuf::Message &message)
+{
+#if GOOGLE_PROTOBUF_VERSION > 3001000
+    const int size = static_cast<int>(message.ByteSizeLong());
+#else
+    const int size = message.ByteSize();
+#endif
+    const int oldSize = batch.size();
+    batch.resize(oldSize + size);
+    message.SerializeToArray(batch.data() + oldSize, size);
+}
+
+void Server_ReplayWriter::appendEvent(const GameEventContainer &event)
+{
+    // key and length prefix of a GameReplay.event_list record, followed by the event itself
+    quint64 key = (GameReplay::kEventListFieldNumber << 3) | 2;
+#if GOOGLE_PROTOBUF_VERSION > 3001000
+    quint64 length = event.ByteSizeLong();
+#else
+    quint64 length = static_cast<quint64>(event.ByteSize());
+#endif
+    for (quint64 value : {key, length}) {
+        while (value >= 0x80) {
+            batch.append(static_cast<char>((value & 0x7f) | 0x80));
+            value >>= 7;
+        }
+        batch.append(static_cast<char>(value));
+    }
+    appendMessage(event);
+
+    if (spoolFile && batch.size() >= batchSize)
+        flushBatch();
+}
+
+void Server_ReplayWriter::flushBatch()
+{
+    if (!spoolFile || batch.isEmpty())
+        return;
+
+    const qint64 oldSize = spoolFile->size();
+    if (spoolFile->write(batch) != batch.size()) {
+        // drop a partial write, the batch is retried on the next flush
+        qDebug() << "Server_ReplayWriter: write to" << spoolFile->fileName() << "failed:" << spoolFile->errorString();
+        spoolFile->resize(oldSize);
+        spoolFile->seek(oldSize);
+        return;
+    }
+    batch.clear();
+}
+
+void Server_ReplayWriter::finish(int _durationSeconds)
+{
+    durationSeconds = _durationSeconds;
+
+    GameReplay trailer;
+    trailer.set_duration_seconds(durationSeconds);
+    appendMessage(trailer);
+
+    flushBatch();
+    if (spoolFile)
+        spoolFile->close();
+}
+
+QByteArray Server_ReplayWriter::readAll()
+{
+    if (!spoolFile)
+        return batch;
+
+    QByteArray result;
+    if (spoolFile->open(QIODevice::ReadOnly)) {
+        result = spoolFile->readAll();
+        spoolFile->close();
+    } else
+        qDebug() << "Server_ReplayWriter: can't read spool file" << spoolFile->fileName();
+    // anything that couldn't be written to the file is still in the batch
+    return result + batch;
+}
@@ -0,0 +1,58 @@
+#ifndef SERVER_REPLAYWRITER_H
+#define SERVER_REPLAYWRITER_H
+
+#include "pb/serverinfo_game.pb.h"
+
+#include <QByteArray>
+#include <QString>
+
+class QFile;
+class GameEventContainer;
+
+/*
+ * Append-only writer for the GameReplay of a running game.
+ * Instead of collecting all events in a GameReplay message, every event is serialized once as an
+ * event_list record of the GameReplay wire format. Records are collected in a small batch which is
+ * appended to a spool file whenever it grows too large, so a long game only keeps its current
+ * batch in memory. As protobuf merges concatenated messages, the file contents are a valid
+ * serialized GameReplay once finish() has been called.
+ * Without a spool directory (or if the file can't be created) the records are kept in memory.
+ */
+class Server_ReplayWriter
+{
+private:
+    static const int batchSize = 65536;
+
+    quint64 replayId;
+    ServerInfo_Game gameInfo;
+    int durationSeconds;
+    QFile *spoolFile;
+    QByteArray batch;
+
+    void appendMessage(const ::google::protobuf::Message &message);
+    void flushBatch();
+
+public:
+    Server_ReplayWriter(quint64 _replayId, const ServerInfo_Game &_gameInfo, const QString &spoolPath);
+    ~Server_ReplayWriter();
+
+    void appendEvent(const GameEventContainer &event);
+    void finish(int _durationSeconds);
+    // Returns the complete serialized GameReplay; only valid after finish()
+    QByteArray readAll();
+
+    quint64 getReplayId() const
+    {
+        return replayId;
+    }
+    const ServerInfo_Game &getGameInfo() const
+    {
+        return gameInfo;
+    }
+    int getDurationSeconds() const
+    {
+        return durationSeconds;
+    }
+};
+
+#endif
@@ -13,6 +13,8 @@
 
 #include <QDateTime>
 #include <QDebug>
+#include <QSet>
+#include <QTimer>
 #include <google/protobuf/descriptor.h>
 
 Server_Room::Server_Room(int _id,
@@ -31,18 +33,26 @@ Server_Room::Server_Room(int _id,
 {
     connect(this, SIGNAL(gameListChanged(ServerInfo_Game)), this, SLOT(broadcastGameListUpdate(ServerInfo_Game)),
             Qt::QueuedConnection);
+
+    gameListUpdateTimer = new QTimer(this);
+    gameListUpdateTimer->setSingleShot(true);
+    connect(gameListUpdateTimer, SIGNAL(timeout()), this, SLOT(flushGameListUpdates()));
 }
 
 Server_Room::~Server_Room()
 {
     qDebug("Server_Room destructor");
 
-    gamesLock.lockForWrite();
-    const QList<Server_Game *> gameList = games.values();
-    for (int i = 0; i < gameList.size(); ++i)
-        delete gameList[i];
-    games.clear();
-    gamesLock.unlock();
+    // A game's destructor waits for the thread of its timer wheel, which may need gamesLock meanwhile, so
+    // the games are deleted one at a time without the lock held; each one removes itself from games.
+    forever {
+        gamesLock.lockForRead();
+        Server_Game *game = games.isEmpty() ? nullptr : games.begin().value();
+        gamesLock.unlock();
+        if (!game)
+            break;
+        delete game;
+    }
 
     usersLock.lockForWrite();
     users.clear();
@@ -296,11 +306,13 @@ void Server_Room::say(const QString &userName, const QString &s, bool sendToIsl)
 
 void Server_Room::sendRoomEvent(RoomEvent *event, bool sendToIsl)
 {
+    const QByteArray serializedEvent = Server_ProtocolHandler::serializeProtocolItem(*event);
+
     usersLock.lockForRead();
     {
         QMapIterator<QString, Server_ProtocolHandler *> userIterator(users);
         while (userIterator.hasNext())
-            userIterator.next().value()->sendProtocolItem(*event);
+            userIterator.next().value()->sendSerializedProtocolItem(serializedEvent);
     }
     usersLock.unlock();
 
@@ -312,9 +324,49 @@ void Server_Room::sendRoomEvent(RoomEvent *event, bool sendToIsl)
 
 void Server_Room::broadcastGameListUpdate(const ServerInfo_Game &gameInfo, bool sendToIsl)
 {
-    Event_ListGames event;
-    event.add_game_list()->CopyFrom(gameInfo);
-    sendRoomEvent(prepareRoomEvent(event), sendToIsl);
+    // This function is always called from the main thread, see addGame() and updateExternalGameList().
+
+    // merge with the update still waiting for this game, the same way the clients merge them into their list
+    ServerInfo_Game &pending = pendingGameListUpdates[gameInfo.game_id()];
+    if (gameInfo.closed() || pending.closed())
+        pending.Clear();
+    if (gameInfo.game_types_size() > 0)
+        pending.clear_game_types();
+    pending.MergeFrom(gameInfo);
+    if (sendToIsl)
+        pendingGameListUpdatesToIsl.insert(gameInfo.game_id());
+
+    const int interval = getServer()->getGameListUpdateInterval();
+    if (interval <= 0)
+        flushGameListUpdates();
+    else if (!gameListUpdateTimer->isActive())
+        gameListUpdateTimer->start(interval);
+}
+
+void Server_Room::flushGameListUpdates()
+{
+    if (pendingGameListUpdates.isEmpty())
+        return;
+
+    Event_ListGames event, islEvent;
+    QMapIterator<int, ServerInfo_Game> updateIterator(pendingGameListUpdates);
+    while (updateIterator.hasNext()) {
+        const ServerInfo_Game &gameInfo = updateIterator.next().value();
+        event.add_game_list()->CopyFrom(gameInfo);
+        if (pendingGameListUpdatesToIsl.contains(updateIterator.key()))
+            islEvent.add_game_list()->CopyFrom(gameInfo);
+    }
+    pendingGameListUpdates.clear();
+    pendingGameListUpdatesToIsl.clear();
+
+    // usually all or none of the games are local, then one event does for both
+    const bool islGetsAll = islEvent.game_list_size() == event.game_list_size();
+    sendRoomEvent(prepareRoomEvent(event), islGetsAll);
+    if (!islGetsAll && islEvent.game_list_size() > 0) {
+        RoomEvent *islRoomEvent = prepareRoomEvent(islEvent);
+        getServer()->sendIsl_RoomEvent(*islRoomEvent);
+        delete islRoomEvent;
+    }
 }
 
 void Server_Room::addGame(Server_Game *game)
@@ -327,6 +379,7 @@ void Server_Room::addGame(Server_Game *game)
 
     game->gameMutex.lock();
     games.insert(game->getGameId(), game);
+    getServer()->addGameCreator(QString::fromStdString(game->getCreatorInfo()->name()), id, game->getGameId());
     ServerInfo_Game gameInfo;
     game->getInfo(gameInfo);
     roomInfo.set_game_count(games.size() + externalGames.size());
@@ -355,6 +408,7 @@ void Server_Room::removeGame(Server_Game *game)
     emit gameListChanged(gameInfo);
 
     games.remove(game->getGameId());
+    getServer()->removeGameCreator(QString::fromStdString(game->getCreatorInfo()->name()), id, game->getGameId());
 
     ServerInfo_Room roomInfo;
     roomInfo.set_room_id(id);
@@ -371,14 +425,7 @@ void Server_Room::removeGame(Server_Game *game)
 
 int Server_Room::getGamesCreatedByUser(const QString &userName) const
 {
-    QReadLocker locker(&gamesLock);
-
-    QMapIterator<int, Server_Game *> gamesIterator(games);
-    int result = 0;
-    while (gamesIterator.hasNext())
-        if (gamesIterator.next().value()->getCreatorInfo()->name() == userName.toStdString())
-            ++result;
-    return result;
+    return getServer()->getGamesCreatedByUser(userName, id);
 }
 
 QList<ServerInfo_Game> Server_Room::getGamesOfUser(const QString &userName) const
@@ -386,10 +433,14 @@ QList<ServerInfo_Game> Server_Room::getGamesOfUser(const QString &userName) cons
     QReadLocker locker(&gamesLock);
 
     QList<ServerInfo_Game> result;
-    QMapIterator<int, Server_Game *> gamesIterator(games);
-    while (gamesIterator.hasNext()) {
-        Server_Game *game = gamesIterator.next().value();
-        if (game->containsUser(userName)) {
+    QSet<int> gameIds;
+    for (const PlayerReference &playerRef : getServer()->getGameUserReferences(userName)) {
+        if (playerRef.getRoomId() != id || gameIds.contains(playerRef.getGameId()))
+            continue;
+        gameIds.insert(playerRef.getGameId());
+
+        Server_Game *game = games.value(playerRef.getGameId());
+        if (game) {
             ServerInfo_Game gameInfo;
             game->getInfo(gameInfo);
             result.append(gameInfo);
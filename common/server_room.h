@@ -10,6 +10,7 @@
 #include <QMutex>
 #include <QObject>
 #include <QReadWriteLock>
+#include <QSet>
 #include <QStringList>
 
 class Server_DatabaseInterface;
@@ -20,6 +21,7 @@ class ServerInfo_Room;
 class ServerInfo_Game;
 class Server_Game;
 class Server;
+class QTimer;
 
 class Command_JoinGame;
 class ResponseContainer;
@@ -47,8 +49,13 @@ private:
     QMap<QString, Server_ProtocolHandler *> users;
     QMap<QString, ServerInfo_User_Container> externalUsers;
     QList<ServerInfo_ChatMessage> chatHistory;
+    // Game list updates waiting for gameListUpdateTimer, by game id; only used in the server's main thread
+    QTimer *gameListUpdateTimer;
+    QMap<int, ServerInfo_Game> pendingGameListUpdates;
+    QSet<int> pendingGameListUpdatesToIsl;
 private slots:
     void broadcastGameListUpdate(const ServerInfo_Game &gameInfo, bool sendToIsl = true);
+    void flushGameListUpdates();
 
 public:
     mutable QReadWriteLock usersLock;
@@ -0,0 +1,102 @@
+#include "server_timerwheel.h"
+
+#include <QThread>
+#include <QThreadStorage>
+#include <QTimer>
+
+static QThreadStorage<Server_TimerWheel *> timerWheels;
+
+Server_TimerWheel::Server_TimerWheel() : QObject(), wheel(slotCount), currentSlot(0)
+{
+    tickTimer = new QTimer(this);
+    connect(tickTimer, SIGNAL(timeout()), this, SLOT(tick()));
+}
+
+Server_TimerWheel *Server_TimerWheel::forCurrentThread()
+{
+    // owned by the thread storage, deleted when the thread exits
+    if (!timerWheels.hasLocalData())
+        timerWheels.setLocalData(new Server_TimerWheel);
+    return timerWheels.localData();
+}
+
+void Server_TimerWheel::insert(Server_TimerWheelClient *client, Entry &entry)
+{
+    entry.slot = (currentSlot + entry.period) % slotCount;
+    entry.rounds = (entry.period - 1) / slotCount;
+    wheel[entry.slot].insert(client);
+}
+
+void Server_TimerWheel::schedule(Server_TimerWheelClient *client, int periodSeconds)
+{
+    Q_ASSERT(QThread::currentThread() == thread());
+    unschedule(client);
+
+    Entry entry;
+    entry.period = qMax(periodSeconds, 1);
+    insert(client, entry);
+    entries.insert(client, entry);
+
+    if (!tickTimer->isActive())
+        tickTimer->start(tickInterval);
+}
+
+void Server_TimerWheel::remove(Server_TimerWheelClient *client)
+{
+    auto it = entries.find(client);
+    if (it == entries.end())
+        return;
+
+    wheel[it->slot].remove(client);
+    entries.erase(it);
+}
+
+void Server_TimerWheel::unschedule(Server_TimerWheelClient *client)
+{
+    Q_ASSERT(QThread::currentThread() == thread());
+    remove(client);
+
+    if (entries.isEmpty())
+        tickTimer->stop();
+}
+
+void Server_TimerWheel::unscheduleQueued(void *client)
+{
+    unschedule(static_cast<Server_TimerWheelClient *>(client));
+}
+
+void Server_TimerWheel::unscheduleFromAnyThread(Server_TimerWheelClient *client)
+{
+    if (QThread::currentThread() == thread()) {
+        unschedule(client);
+    } else if (thread()->isRunning()) {
+        QMetaObject::invokeMethod(this, "unscheduleQueued", Qt::BlockingQueuedConnection,
+                                  Q_ARG(void *, static_cast<void *>(client)));
+    } else {
+        // the thread has stopped, nothing ticks anymore; the timer is left for the thread storage to delete
+        remove(client);
+    }
+}
+
+void Server_TimerWheel::tick()
+{
+    currentSlot = (currentSlot + 1) % slotCount;
+
+    // Iterate over a copy: clients may unschedule themselves or others from their tick.
+    const QSet<Server_TimerWheelClient *> due = wheel[currentSlot];
+    for (Server_TimerWheelClient *client : due) {
+        auto it = entries.find(client);
+        if (it == entries.end() || it->slot != currentSlot)
+            continue;
+
+        if (it->rounds > 0) {
+            --it->rounds;
+            continue;
+        }
+
+        // re-arm before the callback so that it is free to unschedule the client
+        wheel[currentSlot].remove(client);
+        insert(client, *it);
+        client->timerWheelTick();
+    }
+}
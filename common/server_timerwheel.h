@@ -0,0 +1,68 @@
+#ifndef SERVER_TIMERWHEEL_H
+#define SERVER_TIMERWHEEL_H
+
+#include <QHash>
+#include <QObject>
+#include <QSet>
+#include <QVector>
+
+class QTimer;
+
+class Server_TimerWheelClient
+{
+public:
+    virtual ~Server_TimerWheelClient()
+    {
+    }
+    virtual void timerWheelTick() = 0;
+};
+
+/*
+ * Hashed timer wheel shared by all periodic server objects (games, client sessions) of one thread.
+ * A single one second timer drives the wheel; each tick only visits the clients hashed into the
+ * current slot, so the cost of a tick does not depend on how many long period clients are waiting.
+ * All methods except unscheduleFromAnyThread() must be called from the thread the wheel belongs to.
+ */
+class Server_TimerWheel : public QObject
+{
+    Q_OBJECT
+private:
+    struct Entry
+    {
+        int slot;
+        int rounds;
+        int period;
+    };
+
+    static const int slotCount = 64;
+    static const int tickInterval = 1000;
+
+    QTimer *tickTimer;
+    QVector<QSet<Server_TimerWheelClient *>> wheel;
+    QHash<Server_TimerWheelClient *, Entry> entries;
+    int currentSlot;
+
+    Server_TimerWheel();
+    void insert(Server_TimerWheelClient *client, Entry &entry);
+    void remove(Server_TimerWheelClient *client);
+private slots:
+    void tick();
+    void unscheduleQueued(void *client);
+
+public:
+    static Server_TimerWheel *forCurrentThread();
+
+    // Calls client->timerWheelTick() every periodSeconds seconds until the client is unscheduled
+    void schedule(Server_TimerWheelClient *client, int periodSeconds);
+    void unschedule(Server_TimerWheelClient *client);
+    // For clients destroyed by another thread (e.g. games deleted at shutdown): waits until the wheel's
+    // thread has unscheduled the client, so that no tick can reach it afterwards. The caller must not
+    // hold locks the wheel's thread may wait for.
+    void unscheduleFromAnyThread(Server_TimerWheelClient *client);
+    int getClientCount() const
+    {
+        return entries.size();
+    }
+};
+
+#endif
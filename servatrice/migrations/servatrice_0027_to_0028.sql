@@ -0,0 +1,12 @@
+-- Servatrice db migration from version 27 to version 28
+
+CREATE TABLE IF NOT EXISTS `cockatrice_id_blocks` (
+  `name` varchar(16) NOT NULL,
+  `next_id` int(7) unsigned NOT NULL,
+  PRIMARY KEY (`name`)
+) ENGINE=InnoDB DEFAULT CHARSET=utf8mb4 DEFAULT COLLATE utf8mb4_unicode_ci;
+
+INSERT INTO cockatrice_id_blocks (name, next_id) SELECT 'games', COALESCE(MAX(id), 0) + 1 FROM cockatrice_games;
+INSERT INTO cockatrice_id_blocks (name, next_id) SELECT 'replays', COALESCE(MAX(id), 0) + 1 FROM cockatrice_replays;
+
+UPDATE cockatrice_schema_version SET version=28 WHERE version=27;
@@ -20,7 +20,7 @@ CREATE TABLE IF NOT EXISTS `cockatrice_schema_version` (
   PRIMARY KEY  (`version`)
 ) ENGINE=InnoDB DEFAULT CHARSET=utf8mb4 DEFAULT COLLATE utf8mb4_unicode_ci;
 
-INSERT INTO cockatrice_schema_version VALUES(27);
+INSERT INTO cockatrice_schema_version VALUES(28);
 
 -- users and user data tables
 CREATE TABLE IF NOT EXISTS `cockatrice_users` (
@@ -126,8 +126,8 @@ CREATE TABLE IF NOT EXISTS `cockatrice_games_players` (
   FOREIGN KEY(`id_game`) REFERENCES `cockatrice_games`(`id`) ON DELETE CASCADE ON UPDATE CASCADE
 ) ENGINE=InnoDB DEFAULT CHARSET=utf8mb4 DEFAULT COLLATE utf8mb4_unicode_ci;
 
--- Note: an empty row with id_game = NULL is created when the game is created,
--- and then updated when the game ends with the full replay data.
+-- Note: game and replay rows are inserted when the game ends, with ids the server
+-- reserved in blocks from cockatrice_id_blocks when the game was created.
 CREATE TABLE IF NOT EXISTS `cockatrice_replays` (
   `id` int(7) NOT NULL AUTO_INCREMENT,
   `id_game` int(7) unsigned NULL,
@@ -147,6 +147,15 @@ CREATE TABLE IF NOT EXISTS `cockatrice_replays_access` (
   FOREIGN KEY(`id_player`) REFERENCES `cockatrice_users`(`id`)  ON DELETE CASCADE ON UPDATE CASCADE
 ) ENGINE=InnoDB DEFAULT CHARSET=utf8mb4 DEFAULT COLLATE utf8mb4_unicode_ci;
 
+-- next_id is the first game or replay id not reserved by a server yet
+CREATE TABLE IF NOT EXISTS `cockatrice_id_blocks` (
+  `name` varchar(16) NOT NULL,
+  `next_id` int(7) unsigned NOT NULL,
+  PRIMARY KEY (`name`)
+) ENGINE=InnoDB DEFAULT CHARSET=utf8mb4 DEFAULT COLLATE utf8mb4_unicode_ci;
+
+INSERT INTO cockatrice_id_blocks (name, next_id) VALUES ('games', 1), ('replays', 1);
+
 -- server administration
 
 -- Note: unused table
@@ -30,10 +30,13 @@
 #include <QCommandLineParser>
 #include <QCoreApplication>
 #include <QDateTime>
+#include <QElapsedTimer>
 #include <QMetaType>
 #include <QTextCodec>
+#include <QThread>
 #include <QtGlobal>
 #include <google/protobuf/stubs/common.h>
+#include <algorithm>
 #include <iostream>
 
 RNG_Abstract *rng;
@@ -47,6 +50,7 @@ SmtpClient *smtpClient;
 
 void testRNG();
 void testHash();
+void benchmarkShuffle();
 void myMessageOutput(QtMsgType type, const QMessageLogContext &, const QString &msg);
 void myMessageOutput2(QtMsgType type, const QMessageLogContext &, const QString &msg);
 
@@ -97,6 +101,53 @@ void testHash()
     std::cerr << startTime.secsTo(endTime) << "secs" << std::endl;
 }
 
+class ShuffleBenchmarkThread : public QThread
+{
+public:
+    explicit ShuffleBenchmarkThread(int _shuffles) : shuffles(_shuffles)
+    {
+    }
+
+protected:
+    void run() override
+    {
+        // same algorithm as Server_CardZone::shuffle on a 60 card deck
+        QVector<int> deck(60);
+        for (int i = 0; i < deck.size(); ++i)
+            deck[i] = i;
+        for (int n = 0; n < shuffles; ++n)
+            for (int i = deck.size() - 1; i > 0; --i)
+                std::swap(deck[i], deck[rng->rand(0, i)]);
+    }
+
+private:
+    int shuffles;
+};
+
+void benchmarkShuffle()
+{
+    const int n = 200000;
+    std::cerr << "Benchmarking shuffle throughput (n = " << n << " shuffles per thread)..." << std::endl;
+    const int maxThreads = qMax(QThread::idealThreadCount(), 1) * 2;
+    for (int threadCount = 1; threadCount <= maxThreads; threadCount *= 2) {
+        QList<ShuffleBenchmarkThread *> threads;
+        for (int i = 0; i < threadCount; ++i)
+            threads.append(new ShuffleBenchmarkThread(n));
+
+        QElapsedTimer timer;
+        timer.start();
+        for (auto *thread : threads)
+            thread->start();
+        for (auto *thread : threads)
+            thread->wait();
+        const qint64 elapsed = qMax(timer.elapsed(), (qint64)1);
+        qDeleteAll(threads);
+
+        std::cerr << threadCount << " threads:\t" << elapsed << " ms\t" << (qint64)n * threadCount * 1000 / elapsed
+                  << " shuffles/s" << std::endl;
+    }
+}
+
 void myMessageOutput(QtMsgType /*type*/, const QMessageLogContext &, const QString &msg)
 {
     logger->logMessage(msg);
@@ -125,6 +176,9 @@ int main(int argc, char *argv[])
     QCommandLineOption testHashFunctionOpt("test-hash", "Test password hash function");
     parser.addOption(testHashFunctionOpt);
 
+    QCommandLineOption benchmarkShuffleOpt("benchmark-shuffle", "Benchmark shuffle throughput per thread count");
+    parser.addOption(benchmarkShuffleOpt);
+
     QCommandLineOption logToConsoleOpt("log-to-console", "Write server logs to console");
     parser.addOption(logToConsoleOpt);
 
@@ -135,6 +189,7 @@ int main(int argc, char *argv[])
 
     bool testRandom = parser.isSet(testRandomOpt);
     bool testHashFunction = parser.isSet(testHashFunctionOpt);
+    bool shuffleBenchmark = parser.isSet(benchmarkShuffleOpt);
     bool logToConsole = parser.isSet(logToConsoleOpt);
     QString configPath = parser.value(configPathOpt);
 
@@ -171,6 +226,8 @@ int main(int argc, char *argv[])
         testRNG();
     if (testHashFunction)
         testHash();
+    if (shuffleBenchmark)
+        benchmarkShuffle();
 
     smtpClient = new SmtpClient();
 
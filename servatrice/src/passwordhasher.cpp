@@ -3,6 +3,7 @@
 #include "rng_sfmt.h"
 
 #include <QCryptographicHash>
+#include <QMutexLocker>
 
 void PasswordHasher::initialize()
 {
@@ -41,4 +42,57 @@ QString PasswordHasher::generateRandomSalt(const int len)
 QString PasswordHasher::generateActivationToken()
 {
     return QCryptographicHash::hash(generateRandomSalt().toUtf8(), QCryptographicHash::Md5).toBase64().left(16);
-}
\ No newline at end of file
+}
+
+PasswordHashJob::PasswordHashJob(PasswordHashPool *_pool,
+                                 const QString &_address,
+                                 const QString &_password,
+                                 const QString &_salt)
+    : pool(_pool), address(_address), password(_password), salt(_salt)
+{
+    setAutoDelete(false);
+}
+
+void PasswordHashJob::run()
+{
+    const QString hash = PasswordHasher::computeHash(password, salt);
+    pool->jobFinished(address);
+
+    // the receiver gets the result queued in its own thread; if it's gone meanwhile, nobody does
+    emit finished(password, salt, hash);
+    deleteLater();
+}
+
+PasswordHashPool::PasswordHashPool(int threadCount, int _maxJobsPerAddress)
+    : maxJobsPerAddress(qMax(_maxJobsPerAddress, 1))
+{
+    threadPool.setMaxThreadCount(qMax(threadCount, 1));
+}
+
+bool PasswordHashPool::start(const QString &address,
+                             const QString &password,
+                             const QString &salt,
+                             QObject *receiver,
+                             const char *member)
+{
+    {
+        QMutexLocker locker(&jobsMutex);
+        int &jobs = jobsPerAddress[address];
+        if (jobs >= maxJobsPerAddress)
+            return false;
+        ++jobs;
+    }
+
+    auto *job = new PasswordHashJob(this, address, password, salt);
+    QObject::connect(job, SIGNAL(finished(QString, QString, QString)), receiver, member, Qt::QueuedConnection);
+    threadPool.start(job);
+    return true;
+}
+
+void PasswordHashPool::jobFinished(const QString &address)
+{
+    QMutexLocker locker(&jobsMutex);
+    auto jobs = jobsPerAddress.find(address);
+    if (jobs != jobsPerAddress.end() && --jobs.value() <= 0)
+        jobsPerAddress.erase(jobs);
+}
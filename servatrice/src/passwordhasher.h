@@ -1,7 +1,11 @@
 #ifndef PASSWORDHASHER_H
 #define PASSWORDHASHER_H
 
+#include <QHash>
+#include <QMutex>
 #include <QObject>
+#include <QRunnable>
+#include <QThreadPool>
 
 class PasswordHasher
 {
@@ -12,4 +16,50 @@ public:
     static QString generateActivationToken();
 };
 
+class PasswordHashPool;
+
+class PasswordHashJob : public QObject, public QRunnable
+{
+    Q_OBJECT
+private:
+    PasswordHashPool *pool;
+    QString address, password, salt;
+
+public:
+    PasswordHashJob(PasswordHashPool *_pool, const QString &_address, const QString &_password, const QString &_salt);
+    void run() override;
+signals:
+    void finished(const QString &password, const QString &salt, const QString &hash);
+};
+
+/*
+ * Computes password hashes on threads of their own, so that logins and registrations don't stall
+ * the connection pool threads. Each address can only have a few hashes in progress at a time.
+ */
+class PasswordHashPool
+{
+    friend class PasswordHashJob;
+
+private:
+    int maxJobsPerAddress;
+    QMutex jobsMutex;
+    QHash<QString, int> jobsPerAddress;
+    // declared last so that it's destroyed first: its destructor waits for the running jobs, which
+    // still use the members above
+    QThreadPool threadPool;
+
+    void jobFinished(const QString &address);
+
+public:
+    PasswordHashPool(int threadCount, int _maxJobsPerAddress);
+
+    // Queues receiver's member(password, salt, hash) once the hash is computed. Returns false without
+    // hashing anything if the address already has maxJobsPerAddress hashes in progress.
+    bool start(const QString &address,
+               const QString &password,
+               const QString &salt,
+               QObject *receiver,
+               const char *member);
+};
+
 #endif
@@ -26,8 +26,14 @@
 #include "pb/event_connection_closed.pb.h"
 #include "pb/event_server_message.pb.h"
 #include "pb/event_server_shutdown.pb.h"
+#include "passwordhasher.h"
+#include "servatrice_banindex.h"
 #include "servatrice_connection_pool.h"
 #include "servatrice_database_interface.h"
+#include "servatrice_database_writer.h"
+#include "servatrice_idallocator.h"
+#include "servatrice_replay_archiver.h"
+#include "servatrice_userlistcache.h"
 #include "server_logger.h"
 #include "server_room.h"
 #include "serversocketinterface.h"
@@ -36,13 +42,18 @@
 
 #include <QDateTime>
 #include <QDebug>
+#include <QDir>
 #include <QFile>
+#include <QFileInfo>
 #include <QProcessEnvironment>
 #include <QSqlQuery>
 #include <QString>
 #include <QStringList>
+#include <QTcpSocket>
+#include <QThread>
 #include <QTimer>
 #include <QUrl>
+#include <QWebSocket>
 #include <iostream>
 
 Servatrice_GameServer::Servatrice_GameServer(Servatrice *_server,
@@ -109,21 +120,25 @@ Servatrice_ConnectionPool *Servatrice_GameServer::findLeastUsedConnectionPool()
 }
 
 #define WEBSOCKET_POOL_NUMBER 999
+#define REPLAY_ARCHIVER_INSTANCE -2
+#define DATABASE_WRITER_INSTANCE -3
 
 Servatrice_WebsocketGameServer::Servatrice_WebsocketGameServer(Servatrice *_server,
                                                                int _numberPools,
                                                                const QSqlDatabase &_sqlDatabase,
                                                                QObject *parent)
-    : QWebSocketServer("Servatrice", QWebSocketServer::NonSecureMode, parent), server(_server)
+    : QTcpServer(parent), server(_server)
 {
     for (int i = 0; i < _numberPools; ++i) {
         int poolNumber = WEBSOCKET_POOL_NUMBER + i;
         auto newDatabaseInterface = new Servatrice_DatabaseInterface(poolNumber, server);
         auto newPool = new Servatrice_ConnectionPool(newDatabaseInterface);
+        auto newPoolServer = new Servatrice_WebsocketPoolServer(server, newPool);
 
         auto newThread = new QThread;
         newThread->setObjectName("pool_" + QString::number(poolNumber));
         newPool->moveToThread(newThread);
+        newPoolServer->moveToThread(newThread);
         newDatabaseInterface->moveToThread(newThread);
         server->addDatabaseInterface(newThread, newDatabaseInterface);
 
@@ -132,8 +147,7 @@ Servatrice_WebsocketGameServer::Servatrice_WebsocketGameServer(Servatrice *_serv
                                   Q_ARG(QSqlDatabase, _sqlDatabase));
 
         connectionPools.append(newPool);
-
-        connect(this, SIGNAL(newConnection()), this, SLOT(onNewConnection()));
+        poolServers.append(newPoolServer);
     }
 }
 
@@ -142,28 +156,24 @@ Servatrice_WebsocketGameServer::~Servatrice_WebsocketGameServer()
     for (int i = 0; i < connectionPools.size(); ++i) {
         logger->logMessage(QString("Closing websocket pool %1...").arg(i));
         QThread *poolThread = connectionPools[i]->thread();
+        poolServers[i]->deleteLater();
         connectionPools[i]->deleteLater(); // pool destructor calls thread()->quit()
         poolThread->wait();
     }
 }
 
-void Servatrice_WebsocketGameServer::onNewConnection()
+void Servatrice_WebsocketGameServer::incomingConnection(qintptr socketDescriptor)
 {
-    Servatrice_ConnectionPool *pool = findLeastUsedConnectionPool();
-
-    auto ssi = new WebsocketServerSocketInterface(server, pool->getDatabaseInterface());
-    /*
-     * Due to a Qt limitation, websockets can't be moved to another thread.
-     * This will hopefully change in Qt6 if QtWebSocket will be integrated in QtNetwork
-     */
-    // ssi->moveToThread(pool->thread());
-    pool->addClient();
-    connect(ssi, SIGNAL(destroyed()), pool, SLOT(removeClient()));
+    const int poolIndex = findLeastUsedConnectionPool();
+    // count the connection right away like the tcp server does, so a burst doesn't all go to one pool
+    connectionPools[poolIndex]->addClient();
 
-    QMetaObject::invokeMethod(ssi, "initConnection", Qt::QueuedConnection, Q_ARG(void *, nextPendingConnection()));
+    // the websocket handshake is done by the pool thread
+    QMetaObject::invokeMethod(poolServers[poolIndex], "handleSocketDescriptor", Qt::QueuedConnection,
+                              Q_ARG(int, static_cast<int>(socketDescriptor)));
 }
 
-Servatrice_ConnectionPool *Servatrice_WebsocketGameServer::findLeastUsedConnectionPool()
+int Servatrice_WebsocketGameServer::findLeastUsedConnectionPool()
 {
     int minClientCount = -1;
     int poolIndex = -1;
@@ -177,7 +187,60 @@ Servatrice_ConnectionPool *Servatrice_WebsocketGameServer::findLeastUsedConnecti
         debugStr.append(QString::number(clientCount));
     }
     qDebug() << "Pool utilisation:" << debugStr;
-    return connectionPools[poolIndex];
+    return poolIndex;
+}
+
+Servatrice_WebsocketPoolServer::Servatrice_WebsocketPoolServer(Servatrice *_server, Servatrice_ConnectionPool *_pool)
+    : QWebSocketServer("Servatrice", QWebSocketServer::NonSecureMode), server(_server), pool(_pool)
+{
+    connect(this, SIGNAL(newConnection()), this, SLOT(onNewConnection()));
+}
+
+void Servatrice_WebsocketPoolServer::handleSocketDescriptor(int socketDescriptor)
+{
+    auto socket = new QTcpSocket;
+    if (!socket->setSocketDescriptor(socketDescriptor)) {
+        qDebug() << "Websocket pool: invalid socket descriptor" << socketDescriptor;
+        delete socket;
+        pool->removeClient();
+        return;
+    }
+
+    // the connection is already counted in the pool; give the count back if the handshake fails
+    pendingSockets.insert(socket);
+    connect(socket, SIGNAL(disconnected()), this, SLOT(pendingSocketClosed()));
+    connect(socket, SIGNAL(destroyed()), this, SLOT(pendingSocketClosed()));
+
+    // QWebSocketServer takes ownership of the socket and emits newConnection() after the handshake
+    handleConnection(socket);
+}
+
+void Servatrice_WebsocketPoolServer::pendingSocketClosed()
+{
+    if (pendingSockets.remove(static_cast<QTcpSocket *>(sender())))
+        pool->removeClient();
+}
+
+void Servatrice_WebsocketPoolServer::onNewConnection()
+{
+    while (hasPendingConnections()) {
+        QWebSocket *webSocket = nextPendingConnection();
+
+        // from now on the count belongs to the socket interface
+        for (QTcpSocket *pendingSocket : pendingSockets) {
+            if (pendingSocket->peerAddress() == webSocket->peerAddress() &&
+                pendingSocket->peerPort() == webSocket->peerPort()) {
+                disconnect(pendingSocket, nullptr, this, nullptr);
+                pendingSockets.remove(pendingSocket);
+                break;
+            }
+        }
+
+        auto ssi = new WebsocketServerSocketInterface(server, pool->getDatabaseInterface());
+        connect(ssi, SIGNAL(destroyed()), pool, SLOT(removeClient()));
+
+        QMetaObject::invokeMethod(ssi, "initConnection", Qt::QueuedConnection, Q_ARG(void *, webSocket));
+    }
 }
 
 void Servatrice_IslServer::incomingConnection(qintptr socketDescriptor)
@@ -194,8 +257,9 @@ void Servatrice_IslServer::incomingConnection(qintptr socketDescriptor)
 }
 
 Servatrice::Servatrice(QObject *parent)
-    : Server(parent), authenticationMethod(AuthenticationNone), uptime(0), shutdownTimer(nullptr),
-      isFirstShutdownMessage(true)
+    : Server(parent), authenticationMethod(AuthenticationNone), replayArchiver(nullptr), databaseWriter(nullptr),
+      userListCache(nullptr), banIndex(nullptr), gameIdAllocator(nullptr), replayIdAllocator(nullptr),
+      passwordHashPool(nullptr), uptime(0), shutdownTimer(nullptr), isFirstShutdownMessage(true)
 {
     qRegisterMetaType<QSqlDatabase>("QSqlDatabase");
 }
@@ -231,6 +295,26 @@ Servatrice::~Servatrice()
     } while (!done);
 
     prepareDestroy();
+
+    // games closed by prepareDestroy() have queued their replays, the archiver stores them before exiting
+    if (replayArchiver) {
+        QThread *archiverThread = replayArchiver->thread();
+        replayArchiver->deleteLater();
+        archiverThread->wait();
+    }
+
+    // the writer flushes the rows queued until now (e.g. the ends of the sessions closed above) before exiting
+    if (databaseWriter) {
+        QThread *writerThread = databaseWriter->thread();
+        databaseWriter->deleteLater();
+        writerThread->wait();
+    }
+
+    delete passwordHashPool;
+    delete userListCache;
+    delete banIndex;
+    delete gameIdAllocator;
+    delete replayIdAllocator;
 }
 
 bool Servatrice::initServer()
@@ -240,6 +324,11 @@ bool Servatrice::initServer()
     if (getAuthenticationMethodString() == "sql") {
         qDebug() << "Authenticating method: sql";
         authenticationMethod = AuthenticationSql;
+        userListCache = new Servatrice_UserListCache(settingsCache->value("users/listcachettl", 300).toInt());
+        banIndex = new Servatrice_BanIndex;
+        int passwordHashThreads = settingsCache->value("security/password_hash_threads", 2).toInt();
+        int maxPasswordHashesPerAddress = settingsCache->value("security/max_password_hashes_per_address", 2).toInt();
+        passwordHashPool = new PasswordHashPool(passwordHashThreads, maxPasswordHashesPerAddress);
     } else if (getAuthenticationMethodString() == "password") {
         qDebug() << "Authenticating method: password";
         authenticationMethod = AuthenticationPassword;
@@ -316,8 +405,51 @@ bool Servatrice::initServer()
         updateServerList();
         qDebug() << "Clearing previous sessions...";
         servatriceDatabaseInterface->clearSessionTables();
+
+        if (banIndex && !servatriceDatabaseInterface->refreshBanIndex(banIndex, getBanFullRefreshInterval()))
+            qDebug() << "Failed to load the ban index, bans are checked in the database until the next refresh";
+
+        const int idBlockSize = settingsCache->value("database/id_block_size", 1000).toInt();
+        gameIdAllocator = new Servatrice_IdBlockAllocator("games", idBlockSize);
+        replayIdAllocator = new Servatrice_IdBlockAllocator("replays", idBlockSize);
+
+        auto writerDatabaseInterface = new Servatrice_DatabaseInterface(DATABASE_WRITER_INSTANCE, this);
+        const QString defaultSpillFile =
+            QFileInfo(settingsCache->fileName()).absoluteDir().filePath(QString("db_spill_%1.dat").arg(serverId));
+        databaseWriter = new Servatrice_DatabaseWriter(
+            writerDatabaseInterface, settingsCache->value("database/write_spill_file", defaultSpillFile).toString(),
+            qMax(settingsCache->value("database/write_spill_max_size", 64).toLongLong(), (qint64)1) * 1024 * 1024,
+            qMax(settingsCache->value("database/write_queue_size", 10000).toInt(), 1));
+
+        auto writerThread = new QThread;
+        writerThread->setObjectName("db_writer");
+        databaseWriter->moveToThread(writerThread);
+        writerDatabaseInterface->moveToThread(writerThread);
+
+        writerThread->start();
+        QMetaObject::invokeMethod(writerDatabaseInterface, "initDatabase", Qt::BlockingQueuedConnection,
+                                  Q_ARG(QSqlDatabase, servatriceDatabaseInterface->getDatabase()));
+
+        if (getStoreReplaysEnabled()) {
+            initReplaySpool();
+
+            auto archiverDatabaseInterface = new Servatrice_DatabaseInterface(REPLAY_ARCHIVER_INSTANCE, this);
+            replayArchiver = new Servatrice_ReplayArchiver(archiverDatabaseInterface);
+
+            auto archiverThread = new QThread;
+            archiverThread->setObjectName("replay_archiver");
+            replayArchiver->moveToThread(archiverThread);
+            archiverDatabaseInterface->moveToThread(archiverThread);
+
+            archiverThread->start();
+            QMetaObject::invokeMethod(archiverDatabaseInterface, "initDatabase", Qt::BlockingQueuedConnection,
+                                      Q_ARG(QSqlDatabase, servatriceDatabaseInterface->getDatabase()));
+        }
     }
 
+    if (getGameRngSeed() != 0)
+        qDebug() << "Games use the fixed rng seed" << getGameRngSeed();
+
     if (getRoomsMethodString() == "sql") {
         QSqlQuery *query = servatriceDatabaseInterface->prepareQuery(
             "select id, name, descr, permissionlevel, privlevel, auto_join, join_message, chat_history_size from "
@@ -424,10 +556,6 @@ bool Servatrice::initServer()
         return false;
     }
 
-    pingClock = new QTimer(this);
-    connect(pingClock, SIGNAL(timeout()), this, SIGNAL(pingClockTimeout()));
-    pingClock->start(getClientKeepAlive() * 1000);
-
     statusUpdateClock = new QTimer(this);
     connect(statusUpdateClock, SIGNAL(timeout()), this, SLOT(statusUpdate()));
     if (getServerStatusUpdateTime() != 0) {
@@ -435,6 +563,13 @@ bool Servatrice::initServer()
         statusUpdateClock->start(getServerStatusUpdateTime());
     }
 
+    banIndexRefreshClock = new QTimer(this);
+    connect(banIndexRefreshClock, SIGNAL(timeout()), this, SLOT(refreshBanIndex()));
+    if (banIndex && databaseType != DatabaseNone) {
+        const int banRefreshInterval = qMax(settingsCache->value("security/ban_refresh_interval", 30).toInt(), 1);
+        banIndexRefreshClock->start(banRefreshInterval * 1000);
+    }
+
     // SOCKET SERVER
     if (getNumberOfTCPPools() > 0) {
         gameServer =
@@ -520,25 +655,37 @@ QList<ServerProperties> Servatrice::getServerList() const
     return result;
 }
 
+void Servatrice::addClientAddress(AbstractServerSocketInterface *client)
+{
+    QWriteLocker locker(&clientsLock);
+    clientsByAddress[client->getPeerAddress()].insert(client);
+}
+
+void Servatrice::removeClient(Server_ProtocolHandler *client)
+{
+    auto *socketInterface = static_cast<AbstractServerSocketInterface *>(client);
+    clientsLock.lockForWrite();
+    auto addressClients = clientsByAddress.find(socketInterface->getPeerAddress());
+    if (addressClients != clientsByAddress.end()) {
+        addressClients.value().remove(socketInterface);
+        if (addressClients.value().isEmpty())
+            clientsByAddress.erase(addressClients);
+    }
+    clientsLock.unlock();
+
+    Server::removeClient(client);
+}
+
 int Servatrice::getUsersWithAddress(const QHostAddress &address) const
 {
-    int result = 0;
     QReadLocker locker(&clientsLock);
-    for (auto client : clients)
-        if (static_cast<AbstractServerSocketInterface *>(client)->getPeerAddress() == address)
-            ++result;
-
-    return result;
+    return clientsByAddress.value(address).size();
 }
 
 QList<AbstractServerSocketInterface *> Servatrice::getUsersWithAddressAsList(const QHostAddress &address) const
 {
-    QList<AbstractServerSocketInterface *> result;
     QReadLocker locker(&clientsLock);
-    for (auto client : clients)
-        if (static_cast<AbstractServerSocketInterface *>(client)->getPeerAddress() == address)
-            result.append(static_cast<AbstractServerSocketInterface *>(client));
-    return result;
+    return clientsByAddress.value(address).values();
 }
 
 void Servatrice::updateLoginMessage()
@@ -584,9 +731,14 @@ void Servatrice::setRequiredFeatures(const QString featureList)
     qDebug() << "Set required client features to: " << serverRequiredFeatureList;
 }
 
+void Servatrice::refreshBanIndex()
+{
+    servatriceDatabaseInterface->refreshBanIndex(banIndex, getBanFullRefreshInterval());
+}
+
 void Servatrice::statusUpdate()
 {
-    if (!servatriceDatabaseInterface->checkSql())
+    if (!databaseWriter)
         return;
 
     const int uc = getUsersCount(); // for correct mutex locking order
@@ -608,19 +760,11 @@ void Servatrice::statusUpdate()
     rxBytes = 0;
     rxBytesMutex.unlock();
 
-    QSqlQuery *query = servatriceDatabaseInterface->prepareQuery(
-        "insert into {prefix}_uptime (id_server, timest, uptime, users_count, mods_count, mods_list, games_count, "
-        "tx_bytes, rx_bytes) values(:id, NOW(), :uptime, :users_count, :mods_count, :mods_list, :games_count, :tx, "
-        ":rx)");
-    query->bindValue(":id", serverId);
-    query->bindValue(":uptime", uptime);
-    query->bindValue(":users_count", uc);
-    query->bindValue(":mods_count", mc);
-    query->bindValue(":mods_list", ml);
-    query->bindValue(":games_count", gc);
-    query->bindValue(":tx", tx);
-    query->bindValue(":rx", rx);
-    servatriceDatabaseInterface->execSqlQuery(query);
+    const QVariantList uptimeRow = QVariantList() << serverId << uptime << uc << mc << ml << gc << tx << rx;
+    databaseWriter->enqueue(Servatrice_DatabaseWriter::WriteUptime, uptimeRow);
+
+    if (!servatriceDatabaseInterface->checkSql())
+        return;
 
     if (getRegistrationEnabled() && getEnableInternalSMTPClient()) {
         if (getRequireEmailActivationEnabled()) {
@@ -823,7 +967,7 @@ QString Servatrice::getAuthenticationMethodString() const
 
 bool Servatrice::getStoreReplaysEnabled() const
 {
-    return settingsCache->value("game/store_replays", true).toBool();
+    return settingsCache->snapshot()->storeReplays;
 }
 
 int Servatrice::getMaxTcpUserLimit() const
@@ -836,6 +980,11 @@ int Servatrice::getMaxWebSocketUserLimit() const
     return settingsCache->value("security/max_users_websocket", 500).toInt();
 }
 
+int Servatrice::getBanFullRefreshInterval() const
+{
+    return qMax(settingsCache->value("security/ban_full_refresh_interval", 600).toInt(), 1);
+}
+
 bool Servatrice::getRegistrationEnabled() const
 {
     return settingsCache->value("registration/enabled", false).toBool();
@@ -915,52 +1064,62 @@ QString Servatrice::getRoomsMethodString() const
 
 int Servatrice::getMaxGameInactivityTime() const
 {
-    return settingsCache->value("game/max_game_inactivity_time", 120).toInt();
+    return settingsCache->snapshot()->maxGameInactivityTime;
 }
 
 int Servatrice::getMaxPlayerInactivityTime() const
 {
-    return settingsCache->value("server/max_player_inactivity_time", 15).toInt();
+    return settingsCache->snapshot()->maxPlayerInactivityTime;
 }
 
 int Servatrice::getClientKeepAlive() const
 {
-    return settingsCache->value("server/clientkeepalive", 1).toInt();
+    return settingsCache->snapshot()->clientKeepAlive;
 }
 
 int Servatrice::getMaxUsersPerAddress() const
 {
-    return settingsCache->value("security/max_users_per_address", 4).toInt();
+    return settingsCache->snapshot()->maxUsersPerAddress;
+}
+
+int Servatrice::getMaxTcpMessageSize() const
+{
+    return settingsCache->snapshot()->maxTcpMessageSize;
+}
+
+int Servatrice::getTcpOutputHighWaterMark() const
+{
+    return settingsCache->snapshot()->tcpOutputHighWaterMark;
 }
 
 int Servatrice::getMessageCountingInterval() const
 {
-    return settingsCache->value("security/message_counting_interval", 10).toInt();
+    return settingsCache->snapshot()->messageCountingInterval;
 }
 
 int Servatrice::getMaxMessageCountPerInterval() const
 {
-    return settingsCache->value("security/max_message_count_per_interval", 15).toInt();
+    return settingsCache->snapshot()->maxMessageCountPerInterval;
 }
 
 int Servatrice::getMaxMessageSizePerInterval() const
 {
-    return settingsCache->value("security/max_message_size_per_interval", 1000).toInt();
+    return settingsCache->snapshot()->maxMessageSizePerInterval;
 }
 
 int Servatrice::getMaxGamesPerUser() const
 {
-    return settingsCache->value("security/max_games_per_user", 5).toInt();
+    return settingsCache->snapshot()->maxGamesPerUser;
 }
 
 int Servatrice::getCommandCountingInterval() const
 {
-    return settingsCache->value("game/command_counting_interval", 10).toInt();
+    return settingsCache->snapshot()->commandCountingInterval;
 }
 
 int Servatrice::getMaxCommandCountPerInterval() const
 {
-    return settingsCache->value("game/max_command_count_per_interval", 20).toInt();
+    return settingsCache->snapshot()->maxCommandCountPerInterval;
 }
 
 int Servatrice::getServerStatusUpdateTime() const
@@ -978,6 +1137,43 @@ bool Servatrice::permitCreateGameAsJudge() const
     return settingsCache->value("game/allow_create_as_judge", false).toBool();
 }
 
+void Servatrice::initReplaySpool()
+{
+    // every server id gets its own subdirectory, so servers sharing the spool path never touch each other's files
+    const QString defaultPath = QFileInfo(settingsCache->fileName()).absoluteDir().filePath("replay_spool");
+    const QString basePath = settingsCache->value("game/replay_spool_path", defaultPath).toString();
+    QDir spoolDir(QDir(basePath).filePath(QString("server_%1").arg(serverId)));
+    if (!spoolDir.exists() && !spoolDir.mkpath(".")) {
+        qDebug() << "Can't create replay spool directory" << spoolDir.path() << ", replays are kept in memory";
+        return;
+    }
+
+    // spool files left over from a crash of this server can't be finalized anymore
+    const QStringList staleFiles = spoolDir.entryList(QStringList() << "replay_*.spool", QDir::Files);
+    for (const QString &staleFile : staleFiles)
+        spoolDir.remove(staleFile);
+    if (!staleFiles.isEmpty())
+        qDebug() << "Removed" << staleFiles.size() << "stale replay spool files";
+
+    replaySpoolPath = spoolDir.absolutePath();
+    qDebug() << "Replay spool directory:" << replaySpoolPath;
+}
+
+quint32 Servatrice::getGameRngSeed() const
+{
+    return settingsCache->value("game/rng_seed", 0).toUInt();
+}
+
+int Servatrice::getRoomUpdateInterval() const
+{
+    return settingsCache->value("rooms/updateinterval", 250).toInt();
+}
+
+int Servatrice::getGameListUpdateInterval() const
+{
+    return settingsCache->value("rooms/gamelistupdateinterval", 250).toInt();
+}
+
 QHostAddress Servatrice::getServerTCPHost() const
 {
     QString host = settingsCache->value("server/host", "any").toString();
@@ -1036,7 +1232,7 @@ int Servatrice::getISLNetworkPort() const
 
 int Servatrice::getIdleClientTimeout() const
 {
-    return settingsCache->value("server/idleclienttimeout", 3600).toInt();
+    return settingsCache->snapshot()->idleClientTimeout;
 }
 
 bool Servatrice::getEnableLogQuery() const
@@ -22,10 +22,12 @@
 
 #include "server.h"
 
+#include <QHash>
 #include <QHostAddress>
 #include <QMetaType>
 #include <QMutex>
 #include <QReadWriteLock>
+#include <QSet>
 #include <QSqlDatabase>
 #include <QSslCertificate>
 #include <QSslKey>
@@ -36,11 +38,19 @@
 Q_DECLARE_METATYPE(QSqlDatabase)
 
 class QSqlQuery;
+class QTcpSocket;
 class QTimer;
+class PasswordHashPool;
+class Servatrice_BanIndex;
+class Servatrice_DatabaseWriter;
+class Servatrice_IdBlockAllocator;
+class Servatrice_ReplayArchiver;
+class Servatrice_UserListCache;
 
 class GameReplay;
 class Servatrice;
 class Servatrice_ConnectionPool;
+class Servatrice_WebsocketPoolServer;
 class Servatrice_DatabaseInterface;
 class AbstractServerSocketInterface;
 class IslInterface;
@@ -65,12 +75,18 @@ protected:
     Servatrice_ConnectionPool *findLeastUsedConnectionPool();
 };
 
-class Servatrice_WebsocketGameServer : public QWebSocketServer
+/*
+ * Websocket connections are accepted as plain tcp connections on the main thread; the socket descriptor is
+ * handed to the least used pool, where a Servatrice_WebsocketPoolServer performs the websocket handshake.
+ * This way every QWebSocket is created in, and stays on, its pool thread.
+ */
+class Servatrice_WebsocketGameServer : public QTcpServer
 {
     Q_OBJECT
 private:
     Servatrice *server;
     QList<Servatrice_ConnectionPool *> connectionPools;
+    QList<Servatrice_WebsocketPoolServer *> poolServers;
 
 public:
     Servatrice_WebsocketGameServer(Servatrice *_server,
@@ -80,8 +96,26 @@ public:
     ~Servatrice_WebsocketGameServer() override;
 
 protected:
-    Servatrice_ConnectionPool *findLeastUsedConnectionPool();
-protected slots:
+    void incomingConnection(qintptr socketDescriptor) override;
+    int findLeastUsedConnectionPool();
+};
+
+class Servatrice_WebsocketPoolServer : public QWebSocketServer
+{
+    Q_OBJECT
+private:
+    Servatrice *server;
+    Servatrice_ConnectionPool *pool;
+    // handed over and counted in the pool, but the handshake has not finished yet
+    QSet<QTcpSocket *> pendingSockets;
+
+public:
+    Servatrice_WebsocketPoolServer(Servatrice *_server, Servatrice_ConnectionPool *_pool);
+
+public slots:
+    void handleSocketDescriptor(int socketDescriptor);
+private slots:
+    void pendingSocketClosed();
     void onNewConnection();
 };
 
@@ -140,6 +174,7 @@ public:
     };
 private slots:
     void statusUpdate();
+    void refreshBanIndex();
     void shutdownTimeout();
 
 protected:
@@ -153,7 +188,8 @@ private:
     };
     AuthenticationMethod authenticationMethod;
     DatabaseType databaseType;
-    QTimer *pingClock, *statusUpdateClock;
+    QTimer *statusUpdateClock;
+    QTimer *banIndexRefreshClock;
     Servatrice_GameServer *gameServer;
     Servatrice_WebsocketGameServer *websocketGameServer;
     Servatrice_IslServer *islServer;
@@ -164,6 +200,13 @@ private:
     QMap<QString, bool> serverRequiredFeatureList;
     QString officialWarnings;
     Servatrice_DatabaseInterface *servatriceDatabaseInterface;
+    Servatrice_ReplayArchiver *replayArchiver;
+    Servatrice_DatabaseWriter *databaseWriter;
+    Servatrice_UserListCache *userListCache;
+    Servatrice_BanIndex *banIndex;
+    Servatrice_IdBlockAllocator *gameIdAllocator, *replayIdAllocator;
+    PasswordHashPool *passwordHashPool;
+    QString replaySpoolPath;
     int serverId;
     int uptime;
     QMutex txBytesMutex, rxBytesMutex;
@@ -178,8 +221,11 @@ private:
     mutable QMutex serverListMutex;
     QList<ServerProperties> serverList;
     void updateServerList();
+    void initReplaySpool();
 
     QMap<int, IslInterface *> islInterfaces;
+    // Socket interfaces by peer address for the per address connection limit; guarded by clientsLock
+    QHash<QHostAddress, QSet<AbstractServerSocketInterface *>> clientsByAddress;
 
     QString getDBPrefixString() const;
     QString getDBHostNameString() const;
@@ -230,6 +276,38 @@ public:
     {
         return dbPrefix;
     }
+    Servatrice_ReplayArchiver *getReplayArchiver() const
+    {
+        return replayArchiver;
+    }
+    Servatrice_DatabaseWriter *getDatabaseWriter() const
+    {
+        return databaseWriter;
+    }
+    Servatrice_UserListCache *getUserListCache() const
+    {
+        return userListCache;
+    }
+    Servatrice_BanIndex *getBanIndex() const
+    {
+        return banIndex;
+    }
+    Servatrice_IdBlockAllocator *getGameIdAllocator() const
+    {
+        return gameIdAllocator;
+    }
+    Servatrice_IdBlockAllocator *getReplayIdAllocator() const
+    {
+        return replayIdAllocator;
+    }
+    PasswordHashPool *getPasswordHashPool() const
+    {
+        return passwordHashPool;
+    }
+    QString getReplaySpoolPath() const override
+    {
+        return replaySpoolPath;
+    }
     QString getEmailBlackList() const;
     AuthenticationMethod getAuthenticationMethod() const
     {
@@ -263,6 +341,8 @@ public:
     int getMaxPlayerInactivityTime() const override;
     int getClientKeepAlive() const override;
     int getMaxUsersPerAddress() const;
+    int getMaxTcpMessageSize() const;
+    int getTcpOutputHighWaterMark() const;
     int getMessageCountingInterval() const override;
     int getMaxMessageCountPerInterval() const override;
     int getMaxMessageSizePerInterval() const override;
@@ -271,8 +351,15 @@ public:
     int getMaxCommandCountPerInterval() const override;
     int getMaxUserTotal() const override;
     bool permitCreateGameAsJudge() const override;
+    quint32 getGameRngSeed() const override;
+    int getRoomUpdateInterval() const override;
+    int getGameListUpdateInterval() const override;
     int getMaxTcpUserLimit() const;
     int getMaxWebSocketUserLimit() const;
+    int getBanFullRefreshInterval() const;
+    // Called once the peer address of a client passed to addClient() is known
+    void addClientAddress(AbstractServerSocketInterface *client);
+    void removeClient(Server_ProtocolHandler *client) override;
     int getUsersWithAddress(const QHostAddress &address) const;
     int getMaxAccountsPerEmail() const;
     int getForgotPasswordTokenLife() const;
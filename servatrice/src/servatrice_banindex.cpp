@@ -0,0 +1,118 @@
+#include "servatrice_banindex.h"
+
+#include <QDebug>
+
+Servatrice_BanIndex::Servatrice_BanIndex() : loaded(false), clockOffsetSecs(0)
+{
+}
+
+bool Servatrice_BanIndex::isLoaded() const
+{
+    QReadLocker locker(&lock);
+    return loaded;
+}
+
+QDateTime Servatrice_BanIndex::getLastRefresh() const
+{
+    QReadLocker locker(&lock);
+    return lastRefresh;
+}
+
+qint64 Servatrice_BanIndex::getSecondsSinceFullLoad() const
+{
+    QReadLocker locker(&lock);
+    return sinceFullLoad.isValid() ? sinceFullLoad.elapsed() / 1000 : 0;
+}
+
+QDateTime Servatrice_BanIndex::databaseTime() const
+{
+    return QDateTime::currentDateTime().addSecs(clockOffsetSecs);
+}
+
+void Servatrice_BanIndex::storeBan(KeyType keyType, const QString &key, const Ban &ban)
+{
+    if (key.isEmpty())
+        return;
+
+    // the columns compare case insensitively
+    QHash<QString, Ban> &bans = latestBans[keyType];
+    const QString lowerKey = key.toLower();
+    auto latest = bans.find(lowerKey);
+    if (latest == bans.end())
+        bans.insert(lowerKey, ban);
+    else if (latest.value().timeFrom <= ban.timeFrom)
+        latest.value() = ban;
+}
+
+void Servatrice_BanIndex::update(const QList<Ban> &bans, const QDateTime &databaseNow, bool fullLoad)
+{
+    QWriteLocker locker(&lock);
+    if (fullLoad) {
+        for (auto &keyBans : latestBans)
+            keyBans.clear();
+        sinceFullLoad.start();
+    }
+
+    for (const Ban &ban : bans) {
+        storeBan(NameKey, ban.userName, ban);
+        storeBan(AddressKey, ban.address, ban);
+        storeBan(ClientIdKey, ban.clientId, ban);
+    }
+
+    clockOffsetSecs = QDateTime::currentDateTime().secsTo(databaseNow);
+    lastRefresh = databaseNow;
+    loaded = true;
+}
+
+void Servatrice_BanIndex::addBan(Ban ban)
+{
+    QWriteLocker locker(&lock);
+    ban.timeFrom = databaseTime();
+    storeBan(NameKey, ban.userName, ban);
+    storeBan(AddressKey, ban.address, ban);
+    storeBan(ClientIdKey, ban.clientId, ban);
+}
+
+bool Servatrice_BanIndex::checkKey(KeyType keyType, const QString &key, QString &banReason, int &banSecondsRemaining)
+    const
+{
+    if (key.isEmpty())
+        return false;
+
+    auto latest = latestBans[keyType].constFind(key.toLower());
+    if (latest == latestBans[keyType].constEnd())
+        return false;
+
+    const Ban &ban = latest.value();
+    const bool permanentBan = ban.minutes == 0;
+    const qint64 secondsLeft = databaseTime().secsTo(ban.timeFrom.addSecs(qint64(ban.minutes) * 60));
+    if (secondsLeft <= 0 && !permanentBan)
+        return false;
+
+    banReason = ban.visibleReason;
+    banSecondsRemaining = permanentBan ? 0 : static_cast<int>(secondsLeft);
+    return true;
+}
+
+bool Servatrice_BanIndex::check(const QString &ipAddress,
+                                const QString &userName,
+                                const QString &clientId,
+                                QString &banReason,
+                                int &banSecondsRemaining) const
+{
+    QReadLocker locker(&lock);
+
+    if (checkKey(AddressKey, ipAddress, banReason, banSecondsRemaining)) {
+        qDebug() << "User is banned by address" << ipAddress;
+        return true;
+    }
+    if (checkKey(NameKey, userName, banReason, banSecondsRemaining)) {
+        qDebug() << "Username" << userName << "is banned by name";
+        return true;
+    }
+    if (checkKey(ClientIdKey, clientId, banReason, banSecondsRemaining)) {
+        qDebug() << "User is banned by client id" << clientId;
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,75 @@
+#ifndef SERVATRICE_BANINDEX_H
+#define SERVATRICE_BANINDEX_H
+
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+#include <QReadWriteLock>
+#include <QString>
+
+/*
+ * The latest ban of every user name, address and client id, shared by all connection pools so that
+ * logins don't need a database query. The whole bans table is read at startup and every now and then
+ * so that deleted or shortened bans are noticed, in between only the rows added since the previous
+ * refresh; bans issued on this server are added right away. Whatever is not in the index is not banned,
+ * so the common case of a legitimate login never reaches the database.
+ */
+class Servatrice_BanIndex
+{
+public:
+    struct Ban
+    {
+        QString userName, address, clientId;
+        QDateTime timeFrom; // database time
+        int minutes;        // 0 = permanent
+        QString visibleReason;
+        Ban() : minutes(0)
+        {
+        }
+    };
+
+private:
+    enum KeyType
+    {
+        NameKey,
+        AddressKey,
+        ClientIdKey,
+        KeyTypeCount
+    };
+
+    mutable QReadWriteLock lock;
+    QHash<QString, Ban> latestBans[KeyTypeCount];
+    bool loaded;
+    QDateTime lastRefresh;
+    QElapsedTimer sinceFullLoad;
+    qint64 clockOffsetSecs; // database now() minus local time
+
+    // Must be called with the write lock held
+    void storeBan(KeyType keyType, const QString &key, const Ban &ban);
+    // Must be called with the lock held
+    bool checkKey(KeyType keyType, const QString &key, QString &banReason, int &banSecondsRemaining) const;
+    QDateTime databaseTime() const;
+
+public:
+    Servatrice_BanIndex();
+
+    // False until the first successful load, the caller has to ask the database meanwhile
+    bool isLoaded() const;
+    // Database time of the last load, rows added since then (give or take clock skew) are still missing
+    QDateTime getLastRefresh() const;
+    // Seconds since the whole table was last read
+    qint64 getSecondsSinceFullLoad() const;
+    // Merges rows read from the database at databaseNow; fullLoad replaces the whole index
+    void update(const QList<Ban> &bans, const QDateTime &databaseNow, bool fullLoad);
+    // A ban just written by this server; timeFrom is taken from the database clock
+    void addBan(Ban ban);
+    // Same semantics as the address, name and client id ban queries, in that order
+    bool check(const QString &ipAddress,
+               const QString &userName,
+               const QString &clientId,
+               QString &banReason,
+               int &banSecondsRemaining) const;
+};
+
+#endif
@@ -4,6 +4,10 @@
 #include "passwordhasher.h"
 #include "pb/game_replay.pb.h"
 #include "servatrice.h"
+#include "servatrice_database_writer.h"
+#include "servatrice_idallocator.h"
+#include "servatrice_replay_archiver.h"
+#include "servatrice_userlistcache.h"
 #include "serversocketinterface.h"
 #include "settingscache.h"
 
@@ -12,10 +16,13 @@
 #include <QDebug>
 #include <QSqlError>
 #include <QSqlQuery>
+#include <QTimer>
 
 Servatrice_DatabaseInterface::Servatrice_DatabaseInterface(int _instanceId, Servatrice *_server)
-    : instanceId(_instanceId), sqlDatabase(QSqlDatabase()), server(_server)
+    : instanceId(_instanceId), sqlDatabase(QSqlDatabase()), connectionHealthy(false), server(_server)
 {
+    idlePingTimer = new QTimer(this);
+    connect(idlePingTimer, SIGNAL(timeout()), this, SLOT(idlePing()));
 }
 
 Servatrice_DatabaseInterface::~Servatrice_DatabaseInterface()
@@ -52,6 +59,7 @@ bool Servatrice_DatabaseInterface::initDatabase(const QString &type,
 
 bool Servatrice_DatabaseInterface::openDatabase()
 {
+    connectionHealthy = false;
     if (sqlDatabase.isOpen())
         sqlDatabase.close();
 
@@ -62,6 +70,15 @@ bool Servatrice_DatabaseInterface::openDatabase()
         return false;
     }
 
+    // statements prepared on the old connection are prepared again in place, so pointers
+    // held by a query that is being retried stay valid
+    for (auto it = preparedStatements.constBegin(); it != preparedStatements.constEnd(); ++it) {
+        QString prefixedQueryText = it.key();
+        prefixedQueryText.replace("{prefix}", server->getDbPrefix());
+        *it.value() = QSqlQuery(sqlDatabase);
+        it.value()->prepare(prefixedQueryText);
+    }
+
     QSqlQuery *versionQuery = prepareQuery("select version from {prefix}_schema_version limit 1");
     if (!execSqlQuery(versionQuery)) {
         qCritical() << QString("[%1] Error opening database: unable to load database schema version (hint: ensure the "
@@ -95,9 +112,12 @@ bool Servatrice_DatabaseInterface::openDatabase()
         return false;
     }
 
-    // reset all prepared statements
-    qDeleteAll(preparedStatements);
-    preparedStatements.clear();
+    connectionHealthy = true;
+    lastActivity.start();
+
+    const int idlePingInterval = settingsCache->value("database/idle_ping_interval", 0).toInt();
+    if (idlePingInterval > 0 && !idlePingTimer->isActive())
+        idlePingTimer->start(idlePingInterval * 1000);
     return true;
 }
 
@@ -106,11 +126,34 @@ bool Servatrice_DatabaseInterface::checkSql()
     if (!sqlDatabase.isValid())
         return false;
 
-    if (!sqlDatabase.exec("select 1").isActive())
+    // The connection is not probed here: execSqlQuery() notices a lost connection from the error of
+    // the real query, reconnects and retries it. Only a connection already known to be broken is reopened.
+    if (!connectionHealthy || !sqlDatabase.isOpen())
         return openDatabase();
     return true;
 }
 
+void Servatrice_DatabaseInterface::idlePing()
+{
+    if (!sqlDatabase.isValid())
+        return;
+    if (connectionHealthy && lastActivity.isValid() && lastActivity.elapsed() < idlePingTimer->interval())
+        return;
+
+    if (checkSql())
+        execSqlQuery(prepareQuery("select 1"));
+}
+
+bool Servatrice_DatabaseInterface::isConnectionError(const QSqlError &error)
+{
+    if (error.type() == QSqlError::ConnectionError)
+        return true;
+
+    // MySQL client errors: server has gone away, lost connection during query, lost connection to server
+    const QString errorCode = error.nativeErrorCode();
+    return errorCode == "2006" || errorCode == "2013" || errorCode == "2055";
+}
+
 QSqlQuery *Servatrice_DatabaseInterface::prepareQuery(const QString &queryText)
 {
     if (preparedStatements.contains(queryText))
@@ -127,9 +170,47 @@ QSqlQuery *Servatrice_DatabaseInterface::prepareQuery(const QString &queryText)
 
 bool Servatrice_DatabaseInterface::execSqlQuery(QSqlQuery *query)
 {
-    if (query->exec())
+    if (query->exec()) {
+        lastActivity.start();
         return true;
+    }
     const QString poolStr = instanceId == -1 ? QString("main") : QString("pool %1").arg(instanceId);
+
+    // a lost connection is reopened and the query retried once; connectionHealthy is false while
+    // openDatabase() runs its schema check, which keeps this from recursing
+    if (connectionHealthy && isConnectionError(query->lastError())) {
+        qWarning() << QString("[%1] Lost database connection: %2").arg(poolStr).arg(query->lastError().text());
+
+        // 2013 means the connection dropped while the query was running, so it may already have been
+        // applied; only queries that never reached the server are safe to send again. The next query
+        // reconnects.
+        if (query->lastError().nativeErrorCode() == "2013") {
+            qCritical() << QString("[%1] Error executing query: %2").arg(poolStr).arg(query->lastError().text());
+            return false;
+        }
+
+        QVariantList boundValues;
+        const int boundValueCount = query->boundValues().size();
+        for (int i = 0; i < boundValueCount; ++i)
+            boundValues.append(query->boundValue(i));
+
+        const QString queryText = query->lastQuery();
+        const bool cached = !preparedStatements.key(query).isEmpty();
+        if (openDatabase()) {
+            if (!cached) {
+                *query = QSqlQuery(sqlDatabase);
+                query->prepare(queryText);
+            }
+            for (int i = 0; i < boundValues.size(); ++i)
+                query->bindValue(i, boundValues.at(i));
+
+            if (query->exec()) {
+                lastActivity.start();
+                return true;
+            }
+        }
+    }
+
     qCritical() << QString("[%1] Error executing query: %2").arg(poolStr).arg(query->lastError().text());
     return false;
 }
@@ -198,7 +279,7 @@ bool Servatrice_DatabaseInterface::usernameIsValid(const QString &user, QString
 bool Servatrice_DatabaseInterface::registerUser(const QString &userName,
                                                 const QString &realName,
                                                 ServerInfo_User_Gender const &gender,
-                                                const QString &password,
+                                                const QString &passwordSha512,
                                                 const QString &emailAddress,
                                                 const QString &country,
                                                 QString &token,
@@ -207,7 +288,6 @@ bool Servatrice_DatabaseInterface::registerUser(const QString &userName,
     if (!checkSql())
         return false;
 
-    QString passwordSha512 = PasswordHasher::computeHash(password, PasswordHasher::generateRandomSalt());
     token = active ? QString() : PasswordHasher::generateActivationToken();
 
     QSqlQuery *query =
@@ -231,6 +311,8 @@ bool Servatrice_DatabaseInterface::registerUser(const QString &userName,
         return false;
     }
 
+    if (server->getUserListCache())
+        server->getUserListCache()->invalidate(userName);
     return true;
 }
 
@@ -263,6 +345,8 @@ bool Servatrice_DatabaseInterface::activateUser(const QString &userName, const Q
                 return false;
             }
 
+            if (server->getUserListCache())
+                server->getUserListCache()->invalidate(userName);
             return true;
         }
     }
@@ -286,6 +370,7 @@ QChar Servatrice_DatabaseInterface::getGenderChar(ServerInfo_User_Gender const &
 AuthenticationResult Servatrice_DatabaseInterface::checkUserPassword(Server_ProtocolHandler *handler,
                                                                      const QString &user,
                                                                      const QString &password,
+                                                                     const QString &passwordHash,
                                                                      const QString &clientId,
                                                                      QString &reasonStr,
                                                                      int &banSecondsLeft)
@@ -325,7 +410,11 @@ AuthenticationResult Servatrice_DatabaseInterface::checkUserPassword(Server_Prot
                     qDebug("Login denied: user not active");
                     return UserIsInactive;
                 }
-                if (correctPassword == PasswordHasher::computeHash(password, correctPassword.left(16))) {
+                // normally hashed beforehand by the password hash pool; the salt changes with the password
+                const QString salt = correctPassword.left(16);
+                const bool prepared = !passwordHash.isEmpty() && passwordHash.startsWith(salt);
+                const QString hash = prepared ? passwordHash : PasswordHasher::computeHash(password, salt);
+                if (correctPassword == hash) {
                     qDebug("Login accepted: password right");
                     return PasswordRight;
                 } else {
@@ -350,6 +439,10 @@ bool Servatrice_DatabaseInterface::checkUserIsBanned(const QString &ipAddress,
     if (server->getAuthenticationMethod() != Servatrice::AuthenticationSql)
         return false;
 
+    Servatrice_BanIndex *banIndex = server->getBanIndex();
+    if (banIndex && banIndex->isLoaded())
+        return banIndex->check(ipAddress, userName, clientId, banReason, banSecondsRemaining);
+
     if (!checkSql()) {
         qDebug("Failed to check if user is banned. Database invalid.");
         return false;
@@ -360,6 +453,55 @@ bool Servatrice_DatabaseInterface::checkUserIsBanned(const QString &ipAddress,
            checkUserIsIdBanned(clientId, banReason, banSecondsRemaining);
 }
 
+Servatrice_BanIndex::Ban Servatrice_DatabaseInterface::evalBanQueryResult(const QSqlQuery *query)
+{
+    Servatrice_BanIndex::Ban ban;
+    ban.userName = query->value(0).toString();
+    ban.address = query->value(1).toString();
+    ban.clientId = query->value(2).toString();
+    ban.timeFrom = query->value(3).toDateTime();
+    ban.minutes = query->value(4).toInt();
+    ban.visibleReason = query->value(5).toString();
+    return ban;
+}
+
+bool Servatrice_DatabaseInterface::refreshBanIndex(Servatrice_BanIndex *banIndex, int fullLoadInterval)
+{
+    if (!checkSql())
+        return false;
+
+    QSqlQuery *nowQuery = prepareQuery("select now()");
+    if (!execSqlQuery(nowQuery) || !nowQuery->next())
+        return false;
+    const QDateTime databaseNow = nowQuery->value(0).toDateTime();
+
+    // only a full load notices bans that have been deleted or shortened
+    const bool fullLoad = !banIndex->isLoaded() || banIndex->getSecondsSinceFullLoad() >= fullLoadInterval;
+    QSqlQuery *query;
+    if (fullLoad) {
+        query = prepareQuery("select user_name, ip_address, clientid, time_from, minutes, visible_reason from "
+                             "{prefix}_bans");
+    } else {
+        // look back a bit, rows inserted right before the previous refresh may not have been committed yet
+        query = prepareQuery("select user_name, ip_address, clientid, time_from, minutes, visible_reason from "
+                             "{prefix}_bans where time_from >= :since");
+        query->bindValue(":since", banIndex->getLastRefresh().addSecs(-60));
+    }
+    if (!execSqlQuery(query)) {
+        qDebug() << "Ban index refresh failed: SQL error." << query->lastError();
+        return false;
+    }
+
+    QList<Servatrice_BanIndex::Ban> bans;
+    while (query->next())
+        bans.append(evalBanQueryResult(query));
+    banIndex->update(bans, databaseNow, fullLoad);
+
+    if (fullLoad)
+        qDebug() << "Loaded" << bans.size() << "bans";
+    return true;
+}
+
 bool Servatrice_DatabaseInterface::checkUserIsIdBanned(const QString &clientId,
                                                        QString &banReason,
                                                        int &banSecondsRemaining)
@@ -491,6 +633,18 @@ bool Servatrice_DatabaseInterface::userExists(const QString &user)
     return false;
 }
 
+QString Servatrice_DatabaseInterface::getPasswordSalt(const QString &user)
+{
+    if (server->getAuthenticationMethod() != Servatrice::AuthenticationSql || !checkSql())
+        return QString();
+
+    QSqlQuery *query = prepareQuery("select password_sha512 from {prefix}_users where name = :name and active = 1");
+    query->bindValue(":name", user);
+    if (!execSqlQuery(query) || !query->next())
+        return QString();
+    return query->value(0).toString().left(16);
+}
+
 int Servatrice_DatabaseInterface::getUserIdInDB(const QString &name)
 {
     if (server->getAuthenticationMethod() == Servatrice::AuthenticationSql) {
@@ -507,42 +661,64 @@ int Servatrice_DatabaseInterface::getUserIdInDB(const QString &name)
 
 bool Servatrice_DatabaseInterface::isInBuddyList(const QString &whoseList, const QString &who)
 {
-    if (server->getAuthenticationMethod() == Servatrice::AuthenticationNone)
-        return false;
-
-    if (!checkSql())
+    if (server->getAuthenticationMethod() != Servatrice::AuthenticationSql)
         return false;
 
-    int id1 = getUserIdInDB(whoseList);
-    int id2 = getUserIdInDB(who);
-
-    QSqlQuery *query =
-        prepareQuery("select 1 from {prefix}_buddylist where id_user1 = :id_user1 and id_user2 = :id_user2");
-    query->bindValue(":id_user1", id1);
-    query->bindValue(":id_user2", id2);
-    if (!execSqlQuery(query))
-        return false;
-    return query->next();
+    return getUserLists(whoseList).buddyList.contains(who);
 }
 
 bool Servatrice_DatabaseInterface::isInIgnoreList(const QString &whoseList, const QString &who)
 {
-    if (server->getAuthenticationMethod() == Servatrice::AuthenticationNone)
+    if (server->getAuthenticationMethod() != Servatrice::AuthenticationSql)
         return false;
 
+    return getUserLists(whoseList).ignoreList.contains(who);
+}
+
+Servatrice_UserListCache::UserLists Servatrice_DatabaseInterface::getUserLists(const QString &name)
+{
+    Servatrice_UserListCache *cache = server->getUserListCache();
+    Servatrice_UserListCache::UserLists lists;
+    if (cache->find(name, lists))
+        return lists;
+
     if (!checkSql())
-        return false;
+        return lists;
 
-    int id1 = getUserIdInDB(whoseList);
-    int id2 = getUserIdInDB(who);
+    const quint64 loadGeneration = cache->getGeneration();
 
-    QSqlQuery *query =
-        prepareQuery("select 1 from {prefix}_ignorelist where id_user1 = :id_user1 and id_user2 = :id_user2");
-    query->bindValue(":id_user1", id1);
-    query->bindValue(":id_user2", id2);
+    QSqlQuery *query = prepareQuery("select id from {prefix}_users where name = :name and active = 1");
+    query->bindValue(":name", name);
+    if (!execSqlQuery(query))
+        return lists;
+
+    if (query->next()) {
+        lists.userId = query->value(0).toInt();
+        if (!loadUserList("buddylist", lists.userId, lists.buddyList) ||
+            !loadUserList("ignorelist", lists.userId, lists.ignoreList))
+            return Servatrice_UserListCache::UserLists();
+    }
+
+    cache->insert(name, lists, loadGeneration);
+    return lists;
+}
+
+bool Servatrice_DatabaseInterface::loadUserList(const QString &table,
+                                                int userId,
+                                                QMap<QString, ServerInfo_User> &result)
+{
+    QSqlQuery *query = prepareQuery("select a.id, a.name, a.admin, a.country, a.privlevel from {prefix}_users a "
+                                    "join {prefix}_" +
+                                    table + " b on a.id = b.id_user2 where b.id_user1 = :id_user1");
+    query->bindValue(":id_user1", userId);
     if (!execSqlQuery(query))
         return false;
-    return query->next();
+
+    while (query->next()) {
+        const ServerInfo_User &temp = evalUserQueryResult(query, false);
+        result.insert(QString::fromStdString(temp.name()), temp);
+    }
+    return true;
 }
 
 ServerInfo_User Servatrice_DatabaseInterface::evalUserQueryResult(const QSqlQuery *query, bool complete, bool withId)
@@ -632,29 +808,15 @@ ServerInfo_User Servatrice_DatabaseInterface::getUserData(const QString &name, b
 
 void Servatrice_DatabaseInterface::clearSessionTables()
 {
-    lockSessionTables();
     QSqlQuery *query =
         prepareQuery("update {prefix}_sessions set end_time=now() where end_time is null and id_server = :id_server");
     query->bindValue(":id_server", server->getServerID());
     execSqlQuery(query);
-    unlockSessionTables();
-}
-
-void Servatrice_DatabaseInterface::lockSessionTables()
-{
-    QSqlQuery *query = prepareQuery("lock tables {prefix}_sessions write, {prefix}_users read");
-    execSqlQuery(query);
-}
-
-void Servatrice_DatabaseInterface::unlockSessionTables()
-{
-    QSqlQuery *query = prepareQuery("unlock tables");
-    execSqlQuery(query);
 }
 
 bool Servatrice_DatabaseInterface::userSessionExists(const QString &userName)
 {
-    // Call only after lockSessionTables().
+    // Only catches stale rows: live sessions of this server are tracked in Server::users, which is checked first.
 
     QSqlQuery *query = prepareQuery(
         "select 1 from {prefix}_sessions where user_name = :user_name and id_server = :id_server and end_time is null");
@@ -693,62 +855,25 @@ void Servatrice_DatabaseInterface::endSession(qint64 sessionId)
     if (server->getAuthenticationMethod() == Servatrice::AuthenticationNone)
         return;
 
-    if (!checkSql())
-        return;
-
-    QSqlQuery *query = prepareQuery("lock tables {prefix}_sessions write");
-    execSqlQuery(query);
-
-    query = prepareQuery("update {prefix}_sessions set end_time=NOW() where id = :id_session");
-    query->bindValue(":id_session", sessionId);
-    execSqlQuery(query);
-
-    query = prepareQuery("unlock tables");
-    execSqlQuery(query);
+    Servatrice_DatabaseWriter *writer = server->getDatabaseWriter();
+    if (writer)
+        writer->enqueue(Servatrice_DatabaseWriter::WriteSessionEnd, QVariantList() << sessionId);
 }
 
 QMap<QString, ServerInfo_User> Servatrice_DatabaseInterface::getBuddyList(const QString &name)
 {
-    QMap<QString, ServerInfo_User> result;
-
-    if (server->getAuthenticationMethod() == Servatrice::AuthenticationSql) {
-        checkSql();
-
-        QSqlQuery *query = prepareQuery("select a.id, a.name, a.admin, a.country, a.privlevel from {prefix}_users a "
-                                        "left join {prefix}_buddylist b on a.id = b.id_user2 left join {prefix}_users "
-                                        "c on b.id_user1 = c.id where c.name = :name");
-        query->bindValue(":name", name);
-        if (!execSqlQuery(query))
-            return result;
+    if (server->getAuthenticationMethod() != Servatrice::AuthenticationSql)
+        return QMap<QString, ServerInfo_User>();
 
-        while (query->next()) {
-            const ServerInfo_User &temp = evalUserQueryResult(query, false);
-            result.insert(QString::fromStdString(temp.name()), temp);
-        }
-    }
-    return result;
+    return getUserLists(name).buddyList;
 }
 
 QMap<QString, ServerInfo_User> Servatrice_DatabaseInterface::getIgnoreList(const QString &name)
 {
-    QMap<QString, ServerInfo_User> result;
-
-    if (server->getAuthenticationMethod() == Servatrice::AuthenticationSql) {
-        checkSql();
-
-        QSqlQuery *query = prepareQuery("select a.id, a.name, a.admin, a.country, a.privlevel from {prefix}_users a "
-                                        "left join {prefix}_ignorelist b on a.id = b.id_user2 left join {prefix}_users "
-                                        "c on b.id_user1 = c.id where c.name = :name");
-        query->bindValue(":name", name);
-        if (!execSqlQuery(query))
-            return result;
+    if (server->getAuthenticationMethod() != Servatrice::AuthenticationSql)
+        return QMap<QString, ServerInfo_User>();
 
-        while (query->next()) {
-            ServerInfo_User temp = evalUserQueryResult(query, false);
-            result.insert(QString::fromStdString(temp.name()), temp);
-        }
-    }
-    return result;
+    return getUserLists(name).ignoreList;
 }
 
 int Servatrice_DatabaseInterface::getNextGameId()
@@ -756,24 +881,36 @@ int Servatrice_DatabaseInterface::getNextGameId()
     if (!sqlDatabase.isValid())
         return server->getNextLocalGameId();
 
-    if (!checkSql())
-        return -1;
+    return server->getGameIdAllocator()->nextId(this);
+}
 
-    QSqlQuery *query = prepareQuery("insert into {prefix}_games (time_started) values (now())");
-    execSqlQuery(query);
+int Servatrice_DatabaseInterface::getNextReplayId()
+{
+    if (!sqlDatabase.isValid())
+        return -1;
 
-    return query->lastInsertId().toInt();
+    return server->getReplayIdAllocator()->nextId(this);
 }
 
-int Servatrice_DatabaseInterface::getNextReplayId()
+qint64 Servatrice_DatabaseInterface::reserveIdBlock(const QString &sequenceName, int count)
 {
     if (!checkSql())
         return -1;
 
-    QSqlQuery *query = prepareQuery("insert into {prefix}_replays (id_game) values (NULL)");
-    execSqlQuery(query);
+    // last_insert_id(expr) remembers the new value for this connection, the update itself is atomic
+    QSqlQuery *query =
+        prepareQuery("update {prefix}_id_blocks set next_id = last_insert_id(next_id + :count) where name = :name");
+    query->bindValue(":count", count);
+    query->bindValue(":name", sequenceName);
+    if (!execSqlQuery(query) || query->numRowsAffected() != 1)
+        return -1;
+
+    QSqlQuery *idQuery = prepareQuery("select last_insert_id()");
+    if (!execSqlQuery(idQuery) || !idQuery->next())
+        return -1;
 
-    return query->lastInsertId().toInt();
+    const qint64 blockStart = idQuery->value(0).toLongLong() - count;
+    return blockStart > 0 ? blockStart : -1;
 }
 
 void Servatrice_DatabaseInterface::storeGameInformation(const QString &roomName,
@@ -781,7 +918,30 @@ void Servatrice_DatabaseInterface::storeGameInformation(const QString &roomName,
                                                         const ServerInfo_Game &gameInfo,
                                                         const QSet<QString> &allPlayersEver,
                                                         const QSet<QString> &allSpectatorsEver,
-                                                        const QList<GameReplay *> &replayList)
+                                                        const QList<Server_ReplayWriter *> &replayList)
+{
+    Servatrice_ReplayArchiver *archiver = server->getReplayArchiver();
+    if (!archiver) {
+        qDeleteAll(replayList);
+        return;
+    }
+
+    auto *game = new Servatrice_ReplayArchiver::FinishedGame;
+    game->roomName = roomName;
+    game->roomGameTypes = roomGameTypes;
+    game->gameInfo.CopyFrom(gameInfo);
+    game->allPlayersEver = allPlayersEver;
+    game->allSpectatorsEver = allSpectatorsEver;
+    game->replayList = replayList;
+    archiver->enqueue(game);
+}
+
+void Servatrice_DatabaseInterface::writeGameInformation(const QString &roomName,
+                                                        const QStringList &roomGameTypes,
+                                                        const ServerInfo_Game &gameInfo,
+                                                        const QSet<QString> &allPlayersEver,
+                                                        const QSet<QString> &allSpectatorsEver,
+                                                        const QList<Server_ReplayWriter *> &replayList)
 {
     if (!checkSql())
         return;
@@ -809,27 +969,20 @@ void Servatrice_DatabaseInterface::storeGameInformation(const QString &roomName,
 
     QVariantList replayIds, replayGameIds, replayDurations, replayBlobs;
     for (int i = 0; i < replayList.size(); ++i) {
-        QByteArray blob;
-#if GOOGLE_PROTOBUF_VERSION > 3001000
-        const unsigned int size = replayList[i]->ByteSizeLong();
-#else
-        const unsigned int size = replayList[i]->ByteSize();
-#endif
-        blob.resize(size);
-        replayList[i]->SerializeToArray(blob.data(), size);
-
-        replayIds.append(QVariant((qulonglong)replayList[i]->replay_id()));
+        replayIds.append(QVariant((qulonglong)replayList[i]->getReplayId()));
         replayGameIds.append(gameInfo.game_id());
-        replayDurations.append(replayList[i]->duration_seconds());
-        replayBlobs.append(blob);
+        replayDurations.append(replayList[i]->getDurationSeconds());
+        replayBlobs.append(replayList[i]->readAll());
     }
 
     {
-        QSqlQuery *query = prepareQuery("update {prefix}_games set room_name=:room_name, descr=:descr, "
-                                        "creator_name=:creator_name, password=:password, game_types=:game_types, "
-                                        "player_count=:player_count, time_finished=now() where id=:id_game");
+        QSqlQuery *query = prepareQuery(
+            "insert into {prefix}_games (id, room_name, descr, creator_name, password, game_types, player_count, "
+            "time_started, time_finished) values (:id_game, :room_name, :descr, :creator_name, :password, "
+            ":game_types, :player_count, from_unixtime(:time_started), now())");
         query->bindValue(":room_name", roomName);
         query->bindValue(":id_game", gameInfo.game_id());
+        query->bindValue(":time_started", gameInfo.start_time());
         query->bindValue(":descr", QString::fromStdString(gameInfo.description()));
         query->bindValue(":creator_name", QString::fromStdString(gameInfo.creator_info().name()));
         query->bindValue(":password", gameInfo.with_password() ? 1 : 0);
@@ -846,8 +999,8 @@ void Servatrice_DatabaseInterface::storeGameInformation(const QString &roomName,
         query->execBatch();
     }
     {
-        QSqlQuery *query = prepareQuery(
-            "update {prefix}_replays set id_game=:id_game, duration=:duration, replay=:replay where id=:id_replay");
+        QSqlQuery *query = prepareQuery("insert into {prefix}_replays (id, id_game, duration, replay) values "
+                                        "(:id_replay, :id_game, :duration, :replay)");
         query->bindValue(":id_replay", replayIds);
         query->bindValue(":id_game", replayGameIds);
         query->bindValue(":duration", replayDurations);
@@ -916,17 +1069,14 @@ void Servatrice_DatabaseInterface::logMessage(const int senderId,
             return;
     }
 
-    QSqlQuery *query = prepareQuery("insert into {prefix}_log (log_time, sender_id, sender_name, sender_ip, "
-                                    "log_message, target_type, target_id, target_name) values (now(), :sender_id, "
-                                    ":sender_name, :sender_ip, :log_message, :target_type, :target_id, :target_name)");
-    query->bindValue(":sender_id", senderId < 1 ? QVariant() : senderId);
-    query->bindValue(":sender_name", senderName);
-    query->bindValue(":sender_ip", senderIp);
-    query->bindValue(":log_message", logMessage);
-    query->bindValue(":target_type", targetTypeString);
-    query->bindValue(":target_id", (targetType == MessageTargetChat && targetId < 1) ? QVariant() : targetId);
-    query->bindValue(":target_name", targetName);
-    execSqlQuery(query);
+    Servatrice_DatabaseWriter *writer = server->getDatabaseWriter();
+    if (!writer)
+        return;
+
+    QVariantList row;
+    row << (senderId < 1 ? QVariant() : senderId) << senderName << senderIp << logMessage << targetTypeString
+        << ((targetType == MessageTargetChat && targetId < 1) ? QVariant() : targetId) << targetName;
+    writer->enqueue(Servatrice_DatabaseWriter::WriteLogMessage, row);
 }
 
 bool Servatrice_DatabaseInterface::changeUserPassword(const QString &user,
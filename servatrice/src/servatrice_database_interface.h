@@ -1,17 +1,22 @@
 #ifndef SERVATRICE_DATABASE_INTERFACE_H
 #define SERVATRICE_DATABASE_INTERFACE_H
 
+#include "servatrice_banindex.h"
+#include "servatrice_userlistcache.h"
 #include "server.h"
 #include "server_database_interface.h"
 
 #include <QChar>
+#include <QElapsedTimer>
 #include <QHash>
 #include <QObject>
 #include <QSqlDatabase>
 
-#define DATABASE_SCHEMA_VERSION 27
+#define DATABASE_SCHEMA_VERSION 28
 
 class Servatrice;
+class QSqlError;
+class QTimer;
 
 class Servatrice_DatabaseInterface : public Server_DatabaseInterface
 {
@@ -20,8 +25,15 @@ private:
     int instanceId;
     QSqlDatabase sqlDatabase;
     QHash<QString, QSqlQuery *> preparedStatements;
+    bool connectionHealthy;
+    QElapsedTimer lastActivity;
+    QTimer *idlePingTimer;
     Servatrice *server;
+    /** Buddy and ignore lists of a user, from the cache or loaded into it. Only for sql authentication. */
+    Servatrice_UserListCache::UserLists getUserLists(const QString &name);
+    bool loadUserList(const QString &table, int userId, QMap<QString, ServerInfo_User> &result);
     ServerInfo_User evalUserQueryResult(const QSqlQuery *query, bool complete, bool withId = false);
+    static Servatrice_BanIndex::Ban evalBanQueryResult(const QSqlQuery *query);
     /** Must be called after checkSql and server is known to be in auth mode. */
     bool checkUserIsIdBanned(const QString &clientId, QString &banReason, int &banSecondsRemaining);
     /** Must be called after checkSql and server is known to be in auth mode. */
@@ -33,10 +45,14 @@ protected:
     AuthenticationResult checkUserPassword(Server_ProtocolHandler *handler,
                                            const QString &user,
                                            const QString &password,
+                                           const QString &passwordHash,
                                            const QString &clientId,
                                            QString &reasonStr,
                                            int &secondsLeft);
 
+private slots:
+    void idlePing();
+
 public slots:
     void initDatabase(const QSqlDatabase &_sqlDatabase);
 
@@ -52,6 +68,8 @@ public:
     bool checkSql();
     QSqlQuery *prepareQuery(const QString &queryText);
     bool execSqlQuery(QSqlQuery *query);
+    /** Whether the error means the database is unreachable, as opposed to a rejected statement. */
+    static bool isConnectionError(const QSqlError &error);
     const QSqlDatabase &getDatabase()
     {
         return sqlDatabase;
@@ -60,6 +78,8 @@ public:
     bool activeUserExists(const QString &user);
     bool userExists(const QString &user);
     int getUserIdInDB(const QString &name);
+    // Salt of the user's password hash, empty for unknown or inactive users
+    QString getPasswordSalt(const QString &user);
     QMap<QString, ServerInfo_User> getBuddyList(const QString &name);
     QMap<QString, ServerInfo_User> getIgnoreList(const QString &name);
     bool isInBuddyList(const QString &whoseList, const QString &who);
@@ -70,12 +90,22 @@ public:
                               const ServerInfo_Game &gameInfo,
                               const QSet<QString> &allPlayersEver,
                               const QSet<QString> &allSpectatorsEver,
-                              const QList<GameReplay *> &replayList);
+                              const QList<Server_ReplayWriter *> &replayList);
+    void writeGameInformation(const QString &roomName,
+                              const QStringList &roomGameTypes,
+                              const ServerInfo_Game &gameInfo,
+                              const QSet<QString> &allPlayersEver,
+                              const QSet<QString> &allSpectatorsEver,
+                              const QList<Server_ReplayWriter *> &replayList);
     DeckList *getDeckFromDatabase(int deckId, int userId);
 
     int getNextGameId();
     int getNextReplayId();
+    // Reserves count consecutive ids of the "games" or "replays" sequence, returns the first one or -1 on error
+    qint64 reserveIdBlock(const QString &sequenceName, int count);
     int getActiveUserCount(QString connectionType = QString());
+    // Reads the bans table into the index, only the rows added since its last refresh once it is loaded
+    bool refreshBanIndex(Servatrice_BanIndex *banIndex, int fullLoadInterval);
 
     qint64 startSession(const QString &userName,
                         const QString &address,
@@ -83,8 +113,6 @@ public:
                         const QString &connectionType);
     void endSession(qint64 sessionId);
     void clearSessionTables();
-    void lockSessionTables();
-    void unlockSessionTables();
     bool userSessionExists(const QString &userName);
     bool usernameIsValid(const QString &user, QString &error);
     bool checkUserIsBanned(const QString &ipAddress,
@@ -96,7 +124,7 @@ public:
     bool registerUser(const QString &userName,
                       const QString &realName,
                       ServerInfo_User_Gender const &gender,
-                      const QString &password,
+                      const QString &passwordSha512,
                       const QString &emailAddress,
                       const QString &country,
                       QString &token,
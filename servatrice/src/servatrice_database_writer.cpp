@@ -0,0 +1,279 @@
+#include "servatrice_database_writer.h"
+
+#include "servatrice_database_interface.h"
+#include "settingscache.h"
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QDebug>
+#include <QFile>
+#include <QMap>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QStringList>
+#include <QThread>
+#include <QTimer>
+
+Servatrice_DatabaseWriter::Servatrice_DatabaseWriter(Servatrice_DatabaseInterface *_databaseInterface,
+                                                     const QString &_spillFileName,
+                                                     qint64 _maxSpillFileSize,
+                                                     int _maxQueueSize)
+    : databaseInterface(_databaseInterface), spillFileName(_spillFileName), maxSpillFileSize(_maxSpillFileSize),
+      maxQueueSize(_maxQueueSize), droppedWrites(0), connectionLost(false)
+{
+    flushTimer = new QTimer(this);
+    connect(flushTimer, SIGNAL(timeout()), this, SLOT(flush()));
+    // the timer has to be started from the writer's thread
+    QMetaObject::invokeMethod(this, "startFlushTimer", Qt::QueuedConnection);
+}
+
+Servatrice_DatabaseWriter::~Servatrice_DatabaseWriter()
+{
+    flush();
+
+    delete databaseInterface;
+    thread()->quit();
+}
+
+void Servatrice_DatabaseWriter::startFlushTimer()
+{
+    flushTimer->start(qMax(settingsCache->value("database/write_flush_interval", 1000).toInt(), 10));
+}
+
+void Servatrice_DatabaseWriter::enqueue(WriteType type, const QVariantList &values)
+{
+    QMutexLocker locker(&queueMutex);
+    if (queue.size() >= maxQueueSize) {
+        ++droppedWrites;
+        return;
+    }
+
+    PendingWrite write;
+    write.type = type;
+    write.timestamp = QDateTime::currentMSecsSinceEpoch();
+    write.values = values;
+    queue.append(write);
+}
+
+void Servatrice_DatabaseWriter::flush()
+{
+    queueMutex.lock();
+    QList<PendingWrite> pending;
+    pending.swap(queue);
+    const int dropped = droppedWrites;
+    droppedWrites = 0;
+    queueMutex.unlock();
+
+    if (dropped > 0)
+        qCritical() << "[db writer] Write queue full," << dropped << "rows have been dropped";
+
+    if (!databaseInterface->checkSql()) {
+        spill(pending);
+        return;
+    }
+
+    // rows spilled while the database was unavailable go first
+    pending = readSpillFile() + pending;
+    if (pending.isEmpty())
+        return;
+
+    QMap<int, QList<PendingWrite>> rowsByType;
+    for (const PendingWrite &write : pending)
+        rowsByType[write.type].append(write);
+
+    QList<PendingWrite> failed;
+    int rejected = 0;
+    bool databaseOk = true;
+    QMapIterator<int, QList<PendingWrite>> typeIterator(rowsByType);
+    while (typeIterator.hasNext()) {
+        typeIterator.next();
+        const WriteType type = static_cast<WriteType>(typeIterator.key());
+        const QList<PendingWrite> &rows = typeIterator.value();
+        for (int i = 0; i < rows.size(); i += maxRowsPerStatement) {
+            const QList<PendingWrite> chunk = rows.mid(i, maxRowsPerStatement);
+            if (!databaseOk) {
+                failed.append(chunk);
+                continue;
+            }
+            if (writeRows(type, chunk))
+                continue;
+            if (connectionLost) {
+                databaseOk = false;
+                failed.append(chunk);
+                continue;
+            }
+
+            // the database rejected the statement: retry row by row so that only the bad rows are lost
+            for (int j = 0; j < chunk.size(); ++j) {
+                const QList<PendingWrite> row = chunk.mid(j, 1);
+                if (!databaseOk) {
+                    failed.append(row);
+                } else if (!writeRows(type, row)) {
+                    if (connectionLost) {
+                        databaseOk = false;
+                        failed.append(row);
+                    } else
+                        ++rejected;
+                }
+            }
+        }
+    }
+    if (rejected > 0)
+        qCritical() << "[db writer]" << rejected << "rows have been rejected by the database and dropped";
+    spill(failed);
+}
+
+bool Servatrice_DatabaseWriter::writeRows(WriteType type, const QList<PendingWrite> &rows)
+{
+    switch (type) {
+        case WriteLogMessage:
+            return writeLogMessages(rows);
+        case WriteSessionEnd:
+            return writeSessionEnds(rows);
+        case WriteUptime:
+            return writeUptimes(rows);
+    }
+    return true;
+}
+
+bool Servatrice_DatabaseWriter::exec(QSqlQuery *query)
+{
+    if (databaseInterface->execSqlQuery(query))
+        return true;
+    connectionLost = Servatrice_DatabaseInterface::isConnectionError(query->lastError());
+    return false;
+}
+
+static qint64 ageInSeconds(qint64 timestamp, qint64 now)
+{
+    return qMax((now - timestamp) / 1000, (qint64)0);
+}
+
+bool Servatrice_DatabaseWriter::writeLogMessages(const QList<PendingWrite> &rows)
+{
+    QStringList placeholders;
+    for (int i = 0; i < rows.size(); ++i)
+        placeholders.append("(date_sub(now(), interval ? second), ?, ?, ?, ?, ?, ?, ?)");
+
+    QSqlQuery *query =
+        databaseInterface->prepareQuery("insert into {prefix}_log (log_time, sender_id, sender_name, sender_ip, "
+                                        "log_message, target_type, target_id, target_name) values " +
+                                        placeholders.join(", "));
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    int column = 0;
+    for (const PendingWrite &row : rows) {
+        query->bindValue(column++, ageInSeconds(row.timestamp, now));
+        for (const QVariant &value : row.values)
+            query->bindValue(column++, value);
+    }
+    return exec(query);
+}
+
+bool Servatrice_DatabaseWriter::writeSessionEnds(const QList<PendingWrite> &rows)
+{
+    // sessions that ended in the same second share one statement
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    QMap<qint64, QVariantList> sessionIdsByAge;
+    for (const PendingWrite &row : rows)
+        sessionIdsByAge[ageInSeconds(row.timestamp, now)].append(row.values.first());
+
+    QMapIterator<qint64, QVariantList> ageIterator(sessionIdsByAge);
+    while (ageIterator.hasNext()) {
+        ageIterator.next();
+        const QVariantList &sessionIds = ageIterator.value();
+
+        QStringList placeholders;
+        for (int i = 0; i < sessionIds.size(); ++i)
+            placeholders.append("?");
+
+        QSqlQuery *query = databaseInterface->prepareQuery(
+            "update {prefix}_sessions set end_time = date_sub(now(), interval ? second) where id in (" +
+            placeholders.join(", ") + ")");
+        query->bindValue(0, ageIterator.key());
+        for (int i = 0; i < sessionIds.size(); ++i)
+            query->bindValue(i + 1, sessionIds[i]);
+        if (!exec(query))
+            return false;
+    }
+    return true;
+}
+
+bool Servatrice_DatabaseWriter::writeUptimes(const QList<PendingWrite> &rows)
+{
+    QStringList placeholders;
+    for (int i = 0; i < rows.size(); ++i)
+        placeholders.append("(?, date_sub(now(), interval ? second), ?, ?, ?, ?, ?, ?, ?)");
+
+    QSqlQuery *query = databaseInterface->prepareQuery(
+        "insert into {prefix}_uptime (id_server, timest, uptime, users_count, mods_count, mods_list, games_count, "
+        "tx_bytes, rx_bytes) values " +
+        placeholders.join(", "));
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    int column = 0;
+    for (const PendingWrite &row : rows) {
+        query->bindValue(column++, row.values.first());
+        query->bindValue(column++, ageInSeconds(row.timestamp, now));
+        for (int i = 1; i < row.values.size(); ++i)
+            query->bindValue(column++, row.values[i]);
+    }
+    return exec(query);
+}
+
+QList<Servatrice_DatabaseWriter::PendingWrite> Servatrice_DatabaseWriter::readSpillFile()
+{
+    QList<PendingWrite> result;
+    if (spillFileName.isEmpty() || !QFile::exists(spillFileName))
+        return result;
+
+    QFile file(spillFileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qCritical() << "[db writer] Can't read spill file" << spillFileName;
+        return result;
+    }
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_0);
+    while (!in.atEnd() && file.pos() < maxSpillFileSize) {
+        qint32 type;
+        PendingWrite write;
+        in >> type >> write.timestamp >> write.values;
+        if (in.status() != QDataStream::Ok)
+            break;
+        write.type = static_cast<WriteType>(type);
+        result.append(write);
+    }
+    if (!in.atEnd())
+        qCritical() << "[db writer] Spill file too large," << file.size() - file.pos() << "bytes have been dropped";
+    file.close();
+    file.remove();
+
+    qDebug() << "[db writer] Replaying" << result.size() << "spilled rows";
+    return result;
+}
+
+void Servatrice_DatabaseWriter::spill(const QList<PendingWrite> &rows)
+{
+    if (rows.isEmpty())
+        return;
+
+    QFile file(spillFileName);
+    if (spillFileName.isEmpty() || !file.open(QIODevice::Append)) {
+        qCritical() << "[db writer] Database unavailable and no spill file," << rows.size() << "rows have been lost";
+        return;
+    }
+
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_0);
+    int spilled = 0;
+    for (const PendingWrite &write : rows) {
+        // the oldest rows are kept, so the file can't grow without bounds during a long outage
+        if (file.pos() >= maxSpillFileSize)
+            break;
+        out << (qint32)write.type << write.timestamp << write.values;
+        ++spilled;
+    }
+    file.flush();
+    qCritical() << "[db writer] Database unavailable," << spilled << "rows spilled to" << spillFileName;
+    if (spilled < rows.size())
+        qCritical() << "[db writer] Spill file full," << rows.size() - spilled << "rows have been dropped";
+}
@@ -0,0 +1,76 @@
+#ifndef SERVATRICE_DATABASE_WRITER_H
+#define SERVATRICE_DATABASE_WRITER_H
+
+#include <QList>
+#include <QMutex>
+#include <QObject>
+#include <QVariantList>
+
+class QSqlQuery;
+class QTimer;
+class Servatrice_DatabaseInterface;
+
+/*
+ * Write-behind queue for database rows nobody waits for (chat logs, session ends, uptime statistics).
+ * Rows are queued by any thread and written by the writer's own thread and database connection in
+ * multi-row statements every flush interval. Rows that can't be written because the database is down
+ * are appended to a size limited spill file and retried on the next flush, also after a restart. Rows
+ * the database rejects are dropped, as they would never be accepted on a retry either.
+ */
+class Servatrice_DatabaseWriter : public QObject
+{
+    Q_OBJECT
+public:
+    enum WriteType
+    {
+        WriteLogMessage,
+        WriteSessionEnd,
+        WriteUptime
+    };
+
+private:
+    struct PendingWrite
+    {
+        WriteType type;
+        qint64 timestamp; // ms since epoch, written as "now() - age" to be independent of time zones
+        QVariantList values;
+    };
+
+    static const int maxRowsPerStatement = 100;
+
+    Servatrice_DatabaseInterface *databaseInterface;
+    QTimer *flushTimer;
+    QString spillFileName;
+    qint64 maxSpillFileSize; // bytes
+    int maxQueueSize;
+
+    QMutex queueMutex;
+    QList<PendingWrite> queue;
+    int droppedWrites;
+    // set by the last failed statement: the database is unreachable rather than rejecting the rows
+    bool connectionLost;
+
+    bool exec(QSqlQuery *query);
+    bool writeRows(WriteType type, const QList<PendingWrite> &rows);
+    bool writeLogMessages(const QList<PendingWrite> &rows);
+    bool writeSessionEnds(const QList<PendingWrite> &rows);
+    bool writeUptimes(const QList<PendingWrite> &rows);
+    QList<PendingWrite> readSpillFile();
+    void spill(const QList<PendingWrite> &rows);
+
+private slots:
+    void startFlushTimer();
+    void flush();
+
+public:
+    Servatrice_DatabaseWriter(Servatrice_DatabaseInterface *_databaseInterface,
+                              const QString &_spillFileName,
+                              qint64 _maxSpillFileSize,
+                              int _maxQueueSize);
+    ~Servatrice_DatabaseWriter();
+
+    // Thread-safe; never blocks on the database. Rows beyond the queue size are dropped.
+    void enqueue(WriteType type, const QVariantList &values);
+};
+
+#endif
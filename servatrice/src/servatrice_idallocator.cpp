@@ -0,0 +1,27 @@
+#include "servatrice_idallocator.h"
+
+#include "servatrice_database_interface.h"
+
+#include <QDebug>
+
+Servatrice_IdBlockAllocator::Servatrice_IdBlockAllocator(const QString &_sequenceName, int _blockSize)
+    : sequenceName(_sequenceName), blockSize(qMax(_blockSize, 1)), nextFreeId(0), blockEnd(0)
+{
+}
+
+int Servatrice_IdBlockAllocator::nextId(Servatrice_DatabaseInterface *databaseInterface)
+{
+    QMutexLocker locker(&mutex);
+
+    if (nextFreeId >= blockEnd) {
+        const qint64 blockStart = databaseInterface->reserveIdBlock(sequenceName, blockSize);
+        if (blockStart < 0) {
+            qCritical() << "Unable to reserve a block of" << sequenceName << "ids";
+            return -1;
+        }
+        nextFreeId = blockStart;
+        blockEnd = blockStart + blockSize;
+    }
+
+    return static_cast<int>(nextFreeId++);
+}
@@ -0,0 +1,29 @@
+#ifndef SERVATRICE_IDALLOCATOR_H
+#define SERVATRICE_IDALLOCATOR_H
+
+#include <QMutex>
+#include <QString>
+
+class Servatrice_DatabaseInterface;
+
+/*
+ * Hands out game or replay ids from a block reserved in the database, so that creating a game
+ * needs a database round trip only once per block. Shared by all connection pools; ids left over
+ * when the server stops are never used.
+ */
+class Servatrice_IdBlockAllocator
+{
+private:
+    QString sequenceName;
+    int blockSize;
+    QMutex mutex;
+    qint64 nextFreeId, blockEnd;
+
+public:
+    Servatrice_IdBlockAllocator(const QString &_sequenceName, int _blockSize);
+
+    // Returns -1 if the current block is used up and a new one can't be reserved
+    int nextId(Servatrice_DatabaseInterface *databaseInterface);
+};
+
+#endif
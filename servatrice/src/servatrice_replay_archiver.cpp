@@ -0,0 +1,51 @@
+#include "servatrice_replay_archiver.h"
+
+#include "servatrice_database_interface.h"
+#include "server_replaywriter.h"
+
+#include <QThread>
+
+Servatrice_ReplayArchiver::Servatrice_ReplayArchiver(Servatrice_DatabaseInterface *_databaseInterface)
+    : databaseInterface(_databaseInterface)
+{
+}
+
+Servatrice_ReplayArchiver::~Servatrice_ReplayArchiver()
+{
+    // store whatever is left before the thread goes away
+    processQueue();
+
+    delete databaseInterface;
+    thread()->quit();
+}
+
+void Servatrice_ReplayArchiver::enqueue(FinishedGame *game)
+{
+    queueMutex.lock();
+    const bool wasEmpty = queue.isEmpty();
+    queue.append(game);
+    queueMutex.unlock();
+
+    if (wasEmpty)
+        QMetaObject::invokeMethod(this, "processQueue", Qt::QueuedConnection);
+}
+
+void Servatrice_ReplayArchiver::processQueue()
+{
+    forever
+    {
+        queueMutex.lock();
+        if (queue.isEmpty()) {
+            queueMutex.unlock();
+            return;
+        }
+        FinishedGame *game = queue.takeFirst();
+        queueMutex.unlock();
+
+        databaseInterface->writeGameInformation(game->roomName, game->roomGameTypes, game->gameInfo,
+                                                game->allPlayersEver, game->allSpectatorsEver, game->replayList);
+
+        qDeleteAll(game->replayList);
+        delete game;
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef SERVATRICE_REPLAY_ARCHIVER_H
+#define SERVATRICE_REPLAY_ARCHIVER_H
+
+#include "pb/serverinfo_game.pb.h"
+
+#include <QList>
+#include <QMutex>
+#include <QObject>
+#include <QSet>
+#include <QStringList>
+
+class Servatrice_DatabaseInterface;
+class Server_ReplayWriter;
+
+/*
+ * Stores finished games and their replays from a thread of its own, so that closing a game
+ * doesn't block the pool thread the game lived in while the replay blobs are written to the database.
+ */
+class Servatrice_ReplayArchiver : public QObject
+{
+    Q_OBJECT
+public:
+    struct FinishedGame
+    {
+        QString roomName;
+        QStringList roomGameTypes;
+        ServerInfo_Game gameInfo;
+        QSet<QString> allPlayersEver;
+        QSet<QString> allSpectatorsEver;
+        QList<Server_ReplayWriter *> replayList;
+    };
+
+private:
+    Servatrice_DatabaseInterface *databaseInterface;
+    QMutex queueMutex;
+    QList<FinishedGame *> queue;
+
+private slots:
+    void processQueue();
+
+public:
+    Servatrice_ReplayArchiver(Servatrice_DatabaseInterface *_databaseInterface);
+    ~Servatrice_ReplayArchiver();
+
+    // Thread-safe, takes ownership of the game and its replays
+    void enqueue(FinishedGame *game);
+};
+
+#endif
@@ -0,0 +1,122 @@
+#include "servatrice_userlistcache.h"
+
+Servatrice_UserListCache::Servatrice_UserListCache(int ttlSeconds)
+    : ttlMsecs(qint64(qMax(ttlSeconds, 1)) * 1000), generation(0)
+{
+}
+
+bool Servatrice_UserListCache::find(const QString &userName, UserLists &lists) const
+{
+    QReadLocker locker(&lock);
+
+    auto withoutAccount = namesWithoutAccount.constFind(userName);
+    if (withoutAccount != namesWithoutAccount.constEnd()) {
+        if (withoutAccount.value().hasExpired(ttlMsecs))
+            return false;
+        lists = UserLists();
+        return true;
+    }
+
+    auto userId = userIds.constFind(userName);
+    if (userId == userIds.constEnd())
+        return false;
+
+    auto entry = entries.constFind(userId.value());
+    if (entry == entries.constEnd() || entry.value().loaded.hasExpired(ttlMsecs))
+        return false;
+
+    lists = entry.value().lists;
+    return true;
+}
+
+quint64 Servatrice_UserListCache::getGeneration() const
+{
+    QReadLocker locker(&lock);
+    return generation;
+}
+
+void Servatrice_UserListCache::insert(const QString &userName, const UserLists &lists, quint64 loadGeneration)
+{
+    QWriteLocker locker(&lock);
+    if (loadGeneration != generation)
+        return;
+
+    // drop the old entry under this name, the account may have been renamed or replaced
+    removeEntry(userName);
+
+    QElapsedTimer loaded;
+    loaded.start();
+
+    if (lists.userId < 0) {
+        namesWithoutAccount.insert(userName, loaded);
+        return;
+    }
+
+    auto oldEntry = entries.constFind(lists.userId);
+    if (oldEntry != entries.constEnd())
+        userIds.remove(oldEntry.value().userName);
+
+    Entry entry;
+    entry.lists = lists;
+    entry.userName = userName;
+    entry.loaded = loaded;
+    entries.insert(lists.userId, entry);
+    userIds.insert(userName, lists.userId);
+}
+
+void Servatrice_UserListCache::addToList(int userId, ListType list, const ServerInfo_User &user)
+{
+    // the same subset of the user data the lists are loaded with
+    ServerInfo_User listUser;
+    listUser.set_name(user.name());
+    listUser.set_user_level(user.user_level());
+    if (user.has_country())
+        listUser.set_country(user.country());
+    if (user.has_privlevel())
+        listUser.set_privlevel(user.privlevel());
+
+    QWriteLocker locker(&lock);
+    ++generation;
+
+    auto entry = entries.find(userId);
+    if (entry == entries.end())
+        return;
+
+    const QString userName = QString::fromStdString(user.name());
+    if (list == BuddyList)
+        entry.value().lists.buddyList.insert(userName, listUser);
+    else
+        entry.value().lists.ignoreList.insert(userName, listUser);
+}
+
+void Servatrice_UserListCache::removeFromList(int userId, ListType list, const QString &userName)
+{
+    QWriteLocker locker(&lock);
+    ++generation;
+
+    auto entry = entries.find(userId);
+    if (entry == entries.end())
+        return;
+
+    if (list == BuddyList)
+        entry.value().lists.buddyList.remove(userName);
+    else
+        entry.value().lists.ignoreList.remove(userName);
+}
+
+void Servatrice_UserListCache::invalidate(const QString &userName)
+{
+    QWriteLocker locker(&lock);
+    ++generation;
+    removeEntry(userName);
+}
+
+void Servatrice_UserListCache::removeEntry(const QString &userName)
+{
+    namesWithoutAccount.remove(userName);
+    auto userId = userIds.find(userName);
+    if (userId != userIds.end()) {
+        entries.remove(userId.value());
+        userIds.erase(userId);
+    }
+}
@@ -0,0 +1,70 @@
+#ifndef SERVATRICE_USERLISTCACHE_H
+#define SERVATRICE_USERLISTCACHE_H
+
+#include "pb/serverinfo_user.pb.h"
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMap>
+#include <QReadWriteLock>
+#include <QString>
+
+/*
+ * Buddy and ignore lists of the users, shared by all connection pools so that private messages and
+ * game joins don't need a database query. Entries are keyed by user id and loaded on first use;
+ * adding or removing a user to a list updates the owner's entry, everything else (changes made by
+ * other servers, renamed or deleted accounts) is picked up when the entry expires.
+ */
+class Servatrice_UserListCache
+{
+public:
+    enum ListType
+    {
+        BuddyList,
+        IgnoreList
+    };
+
+    struct UserLists
+    {
+        int userId; // -1 for names without an active account, their lists are empty
+        QMap<QString, ServerInfo_User> buddyList;
+        QMap<QString, ServerInfo_User> ignoreList;
+        UserLists() : userId(-1)
+        {
+        }
+    };
+
+private:
+    struct Entry
+    {
+        UserLists lists;
+        QString userName;
+        QElapsedTimer loaded;
+    };
+
+    qint64 ttlMsecs;
+    mutable QReadWriteLock lock;
+    QHash<int, Entry> entries;
+    QHash<QString, int> userIds;
+    QHash<QString, QElapsedTimer> namesWithoutAccount;
+    quint64 generation;
+
+    // Must be called with the write lock held
+    void removeEntry(const QString &userName);
+
+public:
+    explicit Servatrice_UserListCache(int ttlSeconds);
+
+    // Returns false when there is no entry for userName or it has expired
+    bool find(const QString &userName, UserLists &lists) const;
+    // Counter bumped by every change; read it before loading an entry from the database and pass it to insert()
+    quint64 getGeneration() const;
+    // Stores lists loaded from the database, unless the cache changed since the load started
+    void insert(const QString &userName, const UserLists &lists, quint64 loadGeneration);
+    void addToList(int userId, ListType list, const ServerInfo_User &user);
+    void removeFromList(int userId, ListType list, const QString &userName);
+    // Forgets everything about userName, e.g. after the account has been registered or activated
+    void invalidate(const QString &userName);
+};
+
+#endif
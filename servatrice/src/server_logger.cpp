@@ -7,16 +7,34 @@
 #include <QFile>
 #include <QFileInfo>
 #include <QTextStream>
+#include <QTimer>
 #include <iostream>
 
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
+
 ServerLogger::ServerLogger(bool _logToConsole, QObject *parent)
-    : QObject(parent), logToConsole(_logToConsole), flushRunning(false)
+    : QObject(parent), logToConsole(_logToConsole), syncTimer(0), unsyncedData(false), enqueuePos(0),
+      dequeuePos(0), flushScheduled(0), droppedMessages(0)
 {
+    // round the configured queue size up to a power of two so that slots can be addressed with a mask
+    const int queueSize = qMax(settingsCache->value("server/logqueuesize", 16384).toInt(), 2);
+    quint32 capacity = 2;
+    while (capacity < (quint32)queueSize)
+        capacity <<= 1;
+
+    buffer = new LogEntry[capacity];
+    bufferMask = capacity - 1;
+    for (quint32 i = 0; i < capacity; ++i)
+        buffer[i].sequence.storeRelease(i);
 }
 
 ServerLogger::~ServerLogger()
 {
     flushBuffer();
+    syncLog();
+    delete[] buffer;
     // This does not work with the destroyed() signal as this destructor is called after the main event loop is done.
     thread()->quit();
 }
@@ -43,6 +61,10 @@ void ServerLogger::startLog(const QString &logFileName)
         logFile = 0;
 
     connect(this, SIGNAL(sigFlushBuffer()), this, SLOT(flushBuffer()), Qt::QueuedConnection);
+
+    syncTimer = new QTimer(this);
+    connect(syncTimer, SIGNAL(timeout()), this, SLOT(syncLog()));
+    syncTimer->start(qMax(settingsCache->value("server/logsyncinterval", 1000).toInt(), 10));
 }
 
 void ServerLogger::logMessage(QString message, void *caller)
@@ -50,66 +72,104 @@ void ServerLogger::logMessage(QString message, void *caller)
     if (!logFile)
         return;
 
-    QString callerString;
-    if (caller)
-        callerString = QString::number((qulonglong)caller, 16) + " ";
-
     // filter out all log entries based on values in configuration file
-    bool shouldWeWriteLog = settingsCache->value("server/writelog", 1).toBool();
-    QString logFilters = settingsCache->value("server/logfilters").toString();
-#if (QT_VERSION >= QT_VERSION_CHECK(5, 14, 0))
-    QStringList listlogFilters = logFilters.split(",", Qt::SkipEmptyParts);
-#else
-    QStringList listlogFilters = logFilters.split(",", QString::SkipEmptyParts);
-#endif
-    bool shouldWeSkipLine = false;
-
-    if (!shouldWeWriteLog)
+    const SettingsSnapshot *settings = settingsCache->snapshot();
+    if (!settings->writeLog)
         return;
 
-    if (!logFilters.trimmed().isEmpty()) {
-        shouldWeSkipLine = true;
-        foreach (QString logFilter, listlogFilters) {
+    if (!settings->logFilters.isEmpty()) {
+        bool shouldWeSkipLine = true;
+        for (const QString &logFilter : settings->logFilters) {
             if (message.contains(logFilter, Qt::CaseInsensitive)) {
                 shouldWeSkipLine = false;
                 break;
             }
         }
+        if (shouldWeSkipLine)
+            return;
     }
 
-    if (shouldWeSkipLine)
-        return;
+    // Never block the caller: when the logger thread can't keep up the message is dropped and counted.
+    quint32 pos = enqueuePos.loadAcquire();
+    forever
+    {
+        LogEntry &entry = buffer[pos & bufferMask];
+        const qint32 diff = (qint32)(entry.sequence.loadAcquire() - pos);
+        if (diff == 0) {
+            if (enqueuePos.testAndSetOrdered(pos, pos + 1)) {
+                entry.timestamp = QDateTime::currentMSecsSinceEpoch();
+                entry.caller = caller;
+                entry.message = message;
+                entry.sequence.storeRelease(pos + 1);
+                break;
+            }
+            pos = enqueuePos.loadAcquire();
+        } else if (diff < 0) {
+            droppedMessages.fetchAndAddRelaxed(1);
+            return;
+        } else
+            pos = enqueuePos.loadAcquire();
+    }
 
-    bufferMutex.lock();
-    buffer.append(QDateTime::currentDateTime().toString() + " " + callerString + message);
-    bufferMutex.unlock();
-    emit sigFlushBuffer();
+    if (flushScheduled.testAndSetOrdered(0, 1))
+        emit sigFlushBuffer();
 }
 
 void ServerLogger::flushBuffer()
 {
-    if (flushRunning)
+    if (!logFile)
         return;
 
-    flushRunning = true;
-    QTextStream stream(logFile);
+    flushScheduled.storeRelease(0);
+
+    QString batch;
     forever
     {
-        bufferMutex.lock();
-        if (buffer.isEmpty()) {
-            bufferMutex.unlock();
-            flushRunning = false;
-            return;
-        }
-        QString message = buffer.takeFirst();
-        bufferMutex.unlock();
-
-        stream << message << "\n";
-        stream.flush();
-
+        LogEntry &entry = buffer[dequeuePos & bufferMask];
+        if ((qint32)(entry.sequence.loadAcquire() - (dequeuePos + 1)) < 0)
+            break;
+
+        QString message;
+        message.swap(entry.message);
+        const qint64 timestamp = entry.timestamp;
+        void *caller = entry.caller;
+        entry.sequence.storeRelease(dequeuePos + bufferMask + 1);
+        ++dequeuePos;
+
+        QString line = QDateTime::fromMSecsSinceEpoch(timestamp).toString() + " ";
+        if (caller)
+            line += QString::number((qulonglong)caller, 16) + " ";
+        line += message;
+
+        batch += line + "\n";
         if (logToConsole)
-            std::cout << message.toStdString() << std::endl;
+            std::cout << line.toStdString() << std::endl;
     }
+
+    const int dropped = droppedMessages.fetchAndStoreRelaxed(0);
+    if (dropped > 0)
+        batch += QDateTime::currentDateTime().toString() +
+                 QString(" Log queue full, %1 messages have been dropped\n").arg(dropped);
+
+    if (batch.isEmpty())
+        return;
+
+    QTextStream stream(logFile);
+    stream << batch;
+    stream.flush();
+    unsyncedData = true;
+}
+
+void ServerLogger::syncLog()
+{
+    if (!logFile || !unsyncedData)
+        return;
+
+    logFile->flush();
+#ifdef Q_OS_UNIX
+    ::fsync(logFile->handle());
+#endif
+    unsyncedData = false;
 }
 
 void ServerLogger::rotateLogs()
@@ -117,7 +177,14 @@ void ServerLogger::rotateLogs()
     if (!logFile)
         return;
 
+    // the log buffer is drained by the logger thread only
+    if (QThread::currentThread() != thread()) {
+        QMetaObject::invokeMethod(this, "rotateLogs", Qt::QueuedConnection);
+        return;
+    }
+
     flushBuffer();
+    syncLog();
 
     logFile->close();
     logFile->open(QIODevice::Append);
@@ -1,13 +1,13 @@
 #ifndef SERVER_LOGGER_H
 #define SERVER_LOGGER_H
 
-#include <QMutex>
+#include <QAtomicInt>
 #include <QObject>
 #include <QStringList>
 #include <QThread>
-#include <QWaitCondition>
 
 class QFile;
+class QTimer;
 class Server_ProtocolHandler;
 
 class ServerLogger : public QObject
@@ -22,15 +22,32 @@ public slots:
     void rotateLogs();
 private slots:
     void flushBuffer();
+    void syncLog();
 signals:
     void sigFlushBuffer();
 
 private:
+    // Slot of the bounded multi-producer / single-consumer ring buffer. A producer owns the slot
+    // while sequence == its ticket, the logger thread owns it while sequence == ticket + 1.
+    struct LogEntry
+    {
+        QAtomicInteger<quint32> sequence;
+        qint64 timestamp;
+        void *caller;
+        QString message;
+    };
+
     bool logToConsole;
     static QFile *logFile;
-    bool flushRunning;
-    QStringList buffer;
-    QMutex bufferMutex;
+    QTimer *syncTimer;
+    bool unsyncedData;
+
+    LogEntry *buffer;
+    quint32 bufferMask;
+    QAtomicInteger<quint32> enqueuePos;
+    quint32 dequeuePos;
+    QAtomicInt flushScheduled;
+    QAtomicInt droppedMessages;
 };
 
 #endif
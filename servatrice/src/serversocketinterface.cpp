@@ -21,7 +21,9 @@
 #include "serversocketinterface.h"
 
 #include "decklist.h"
+#include "get_pb_extension.h"
 #include "main.h"
+#include "passwordhasher.h"
 #include "pb/command_deck_del.pb.h"
 #include "pb/command_deck_del_dir.pb.h"
 #include "pb/command_deck_download.pb.h"
@@ -56,8 +58,10 @@
 #include "pb/serverinfo_deckstorage.pb.h"
 #include "pb/serverinfo_replay.pb.h"
 #include "pb/serverinfo_user.pb.h"
+#include "pb/session_commands.pb.h"
 #include "servatrice.h"
 #include "servatrice_database_interface.h"
+#include "servatrice_userlistcache.h"
 #include "server_logger.h"
 #include "server_player.h"
 #include "server_response_containers.h"
@@ -66,11 +70,13 @@
 
 #include <QDateTime>
 #include <QDebug>
+#include <QHash>
 #include <QHostAddress>
 #include <QSqlError>
 #include <QSqlQuery>
 #include <QString>
 #include <iostream>
+#include <limits>
 #include <string>
 
 static const int protocolVersion = 14;
@@ -78,8 +84,9 @@ static const int protocolVersion = 14;
 AbstractServerSocketInterface::AbstractServerSocketInterface(Servatrice *_server,
                                                              Servatrice_DatabaseInterface *_databaseInterface,
                                                              QObject *parent)
-    : Server_ProtocolHandler(_server, _databaseInterface, parent), servatrice(_server),
-      sqlInterface(reinterpret_cast<Servatrice_DatabaseInterface *>(databaseInterface))
+    : Server_ProtocolHandler(_server, _databaseInterface, parent), servatrice(_server), outputQueueBytes(0),
+      sqlInterface(reinterpret_cast<Servatrice_DatabaseInterface *>(databaseInterface)), commandLogCounter(0),
+      deferredCommandContainer(nullptr), processingDeferredCommand(false)
 {
     // Never call flushOutputQueue directly from outputQueueChanged. In case of a socket error,
     // it could lead to this object being destroyed while another function is still on the call stack. -> mutex
@@ -87,6 +94,82 @@ AbstractServerSocketInterface::AbstractServerSocketInterface(Servatrice *_server
     connect(this, SIGNAL(outputQueueChanged()), this, SLOT(flushOutputQueue()), Qt::QueuedConnection);
 }
 
+AbstractServerSocketInterface::~AbstractServerSocketInterface()
+{
+    delete deferredCommandContainer;
+}
+
+bool AbstractServerSocketInterface::deferCommandContainer(const CommandContainer &cont)
+{
+    if (!servatrice->getPasswordHashPool() || processingDeferredCommand || cont.session_command_size() != 1)
+        return false;
+
+    // registrations are deferred by cmdRegisterAccount itself, once the cheap checks have passed
+    const SessionCommand &sc = cont.session_command(0);
+    if ((SessionCommand::SessionCommandType)getPbExtension(sc) != SessionCommand::LOGIN || userInfo)
+        return false;
+
+    const Command_Login &cmd = sc.GetExtension(Command_Login::ext);
+    const QString salt = sqlInterface->getPasswordSalt(QString::fromStdString(cmd.user_name()).simplified());
+    // e.g. unknown users: nothing to hash
+    if (salt.isEmpty())
+        return false;
+
+    if (!startPasswordHash(cont, QString::fromStdString(cmd.password()), salt)) {
+        ResponseContainer rc(cont.has_cmd_id() ? cont.cmd_id() : -1);
+        sendResponseContainer(rc, Response::RespTooManyRequests);
+    }
+    return true;
+}
+
+bool AbstractServerSocketInterface::startPasswordHash(const CommandContainer &cont,
+                                                      const QString &password,
+                                                      const QString &salt)
+{
+    PasswordHashPool *hashPool = servatrice->getPasswordHashPool();
+    if (deferredCommandContainer ||
+        !hashPool->start(getAddress(), password, salt, this,
+                         SLOT(passwordHashComputed(const QString &, const QString &, const QString &))))
+        return false;
+
+    deferredCommandContainer = new CommandContainer(cont);
+    return true;
+}
+
+void AbstractServerSocketInterface::passwordHashComputed(const QString &password,
+                                                         const QString &salt,
+                                                         const QString &hash)
+{
+    if (!deferredCommandContainer)
+        return;
+
+    const CommandContainer cont(*deferredCommandContainer);
+    delete deferredCommandContainer;
+    deferredCommandContainer = nullptr;
+
+    preparedPasswordHash.password = password;
+    preparedPasswordHash.salt = salt;
+    preparedPasswordHash.hash = hash;
+    processingDeferredCommand = true;
+    processCommandContainer(cont);
+    processingDeferredCommand = false;
+    preparedPasswordHash = PreparedPasswordHash();
+}
+
+QString AbstractServerSocketInterface::getPreparedPasswordHash(const QString &password) const
+{
+    return preparedPasswordHash.password == password ? preparedPasswordHash.hash : QString();
+}
+
+QString AbstractServerSocketInterface::hashPassword(const QString &password, const QString &salt)
+{
+    if (!preparedPasswordHash.hash.isEmpty() && preparedPasswordHash.password == password &&
+        (salt.isEmpty() || preparedPasswordHash.salt == salt))
+        return preparedPasswordHash.hash;
+
+    return PasswordHasher::computeHash(password, salt.isEmpty() ? PasswordHasher::generateRandomSalt() : salt);
+}
+
 bool AbstractServerSocketInterface::initSession()
 {
     Event_ServerIdentification identEvent;
@@ -128,9 +211,23 @@ void AbstractServerSocketInterface::catchSocketDisconnected()
 }
 
 void AbstractServerSocketInterface::transmitProtocolItem(const ServerMessage &item)
+{
+    QByteArray buf;
+#if GOOGLE_PROTOBUF_VERSION > 3001000
+    buf.resize(static_cast<int>(item.ByteSizeLong()));
+#else
+    buf.resize(item.ByteSize());
+#endif
+    item.SerializeToArray(buf.data(), buf.size());
+
+    transmitSerializedProtocolItem(buf);
+}
+
+void AbstractServerSocketInterface::transmitSerializedProtocolItem(const QByteArray &item)
 {
     outputQueueMutex.lock();
     outputQueue.append(item);
+    outputQueueBytes += item.size();
     outputQueueMutex.unlock();
 
     emit outputQueueChanged();
@@ -141,6 +238,41 @@ void AbstractServerSocketInterface::logDebugMessage(const QString &message)
     logger->logMessage(message, this);
 }
 
+bool AbstractServerSocketInterface::isCommandLogged(CommandLogCategory category, int commandType)
+{
+    const SettingsSnapshot *settings = settingsCache->snapshot();
+    if (!settings->writeLog)
+        return false;
+
+    // commandloglevel: 0 = nothing, 1 = moderator and admin commands, 2 = also session and room commands,
+    // 3 = also game commands
+    switch (category) {
+        case SessionCommandLog:
+            if (settings->commandLogLevel < 2 || settings->commandLogExcludedSession.contains(commandType))
+                return false;
+            break;
+        case RoomCommandLog:
+            if (settings->commandLogLevel < 2 || settings->commandLogExcludedRoom.contains(commandType))
+                return false;
+            break;
+        case GameCommandLog:
+            if (settings->commandLogLevel < 3 || settings->commandLogExcludedGame.contains(commandType))
+                return false;
+            break;
+        case ModeratorCommandLog:
+            // moderator and admin commands are never sampled
+            return settings->commandLogLevel >= 1 && !settings->commandLogExcludedModerator.contains(commandType);
+        case AdminCommandLog:
+            return settings->commandLogLevel >= 1 && !settings->commandLogExcludedAdmin.contains(commandType);
+    }
+
+    if (settings->commandLogSampling <= 1)
+        return true;
+    if (++commandLogCounter >= settings->commandLogSampling)
+        commandLogCounter = 0;
+    return commandLogCounter == 0;
+}
+
 Response::ResponseCode AbstractServerSocketInterface::processExtendedSessionCommand(int cmdType,
                                                                                     const SessionCommand &cmd,
                                                                                     ResponseContainer &rc)
@@ -267,9 +399,13 @@ Response::ResponseCode AbstractServerSocketInterface::cmdAddToList(const Command
     if (!sqlInterface->execSqlQuery(query))
         return Response::RespInternalError;
 
+    const ServerInfo_User &listUser = databaseInterface->getUserData(user);
+    servatrice->getUserListCache()->addToList(
+        id1, list == "buddy" ? Servatrice_UserListCache::BuddyList : Servatrice_UserListCache::IgnoreList, listUser);
+
     Event_AddToList event;
     event.set_list_name(cmd.list());
-    event.mutable_user_info()->CopyFrom(databaseInterface->getUserData(user));
+    event.mutable_user_info()->CopyFrom(listUser);
     rc.enqueuePreResponseItem(ServerMessage::SESSION_EVENT, prepareSessionEvent(event));
 
     return Response::RespOk;
@@ -306,6 +442,9 @@ Response::ResponseCode AbstractServerSocketInterface::cmdRemoveFromList(const Co
     if (!sqlInterface->execSqlQuery(query))
         return Response::RespInternalError;
 
+    servatrice->getUserListCache()->removeFromList(
+        id1, list == "buddy" ? Servatrice_UserListCache::BuddyList : Servatrice_UserListCache::IgnoreList, user);
+
     Event_RemoveFromList event;
     event.set_list_name(cmd.list());
     event.set_user_name(cmd.user_name());
@@ -342,45 +481,41 @@ int AbstractServerSocketInterface::getDeckPathId(const QString &path)
     return getDeckPathId(0, path.split("/"));
 }
 
-bool AbstractServerSocketInterface::deckListHelper(int folderId, ServerInfo_DeckStorage_Folder *folder)
+bool AbstractServerSocketInterface::loadDeckFolders(QMap<int, QMap<int, QString>> &foldersByParent)
 {
-    QSqlQuery *query = sqlInterface->prepareQuery(
-        "select id, name from {prefix}_decklist_folders where id_parent = :id_parent and id_user = :id_user");
-    query->bindValue(":id_parent", folderId);
+    QSqlQuery *query = sqlInterface->prepareQuery("select id, id_parent, name from {prefix}_decklist_folders "
+                                                  "where id_user = :id_user");
     query->bindValue(":id_user", userInfo->id());
     if (!sqlInterface->execSqlQuery(query))
         return false;
 
-    QMap<int, QString> results;
     while (query->next())
-        results[query->value(0).toInt()] = query->value(1).toString();
+        foldersByParent[query->value(1).toInt()].insert(query->value(0).toInt(), query->value(2).toString());
+    return true;
+}
 
-    foreach (int key, results.keys()) {
+void AbstractServerSocketInterface::deckListHelper(int folderId,
+                                                   ServerInfo_DeckStorage_Folder *folder,
+                                                   const QMap<int, QMap<int, QString>> &foldersByParent,
+                                                   const QMap<int, QList<DeckFileRow>> &filesByFolder)
+{
+    const QMap<int, QString> subFolders = foldersByParent.value(folderId);
+    for (auto it = subFolders.constBegin(); it != subFolders.constEnd(); ++it) {
         ServerInfo_DeckStorage_TreeItem *newItem = folder->add_items();
-        newItem->set_id(key);
-        newItem->set_name(results.value(key).toStdString());
+        newItem->set_id(it.key());
+        newItem->set_name(it.value().toStdString());
 
-        if (!deckListHelper(newItem->id(), newItem->mutable_folder()))
-            return false;
+        deckListHelper(it.key(), newItem->mutable_folder(), foldersByParent, filesByFolder);
     }
 
-    query = sqlInterface->prepareQuery("select id, name, upload_time from {prefix}_decklist_files where id_folder = "
-                                       ":id_folder and id_user = :id_user");
-    query->bindValue(":id_folder", folderId);
-    query->bindValue(":id_user", userInfo->id());
-    if (!sqlInterface->execSqlQuery(query))
-        return false;
-
-    while (query->next()) {
+    for (const DeckFileRow &file : filesByFolder.value(folderId)) {
         ServerInfo_DeckStorage_TreeItem *newItem = folder->add_items();
-        newItem->set_id(query->value(0).toInt());
-        newItem->set_name(query->value(1).toString().toStdString());
+        newItem->set_id(file.id);
+        newItem->set_name(file.name.toStdString());
 
         ServerInfo_DeckStorage_File *newFile = newItem->mutable_file();
-        newFile->set_creation_time(query->value(2).toDateTime().toTime_t());
+        newFile->set_creation_time(file.uploadTime.toTime_t());
     }
-
-    return true;
 }
 
 // CHECK AUTHENTICATION!
@@ -394,12 +529,29 @@ Response::ResponseCode AbstractServerSocketInterface::cmdDeckList(const Command_
 
     sqlInterface->checkSql();
 
-    Response_DeckList *re = new Response_DeckList;
-    ServerInfo_DeckStorage_Folder *root = re->mutable_root();
+    // the whole tree is loaded with one query for the folders and one for the files, then assembled here
+    QMap<int, QMap<int, QString>> foldersByParent;
+    if (!loadDeckFolders(foldersByParent))
+        return Response::RespContextError;
 
-    if (!deckListHelper(0, root))
+    QSqlQuery *query = sqlInterface->prepareQuery(
+        "select id, id_folder, name, upload_time from {prefix}_decklist_files where id_user = :id_user");
+    query->bindValue(":id_user", userInfo->id());
+    if (!sqlInterface->execSqlQuery(query))
         return Response::RespContextError;
 
+    QMap<int, QList<DeckFileRow>> filesByFolder;
+    while (query->next()) {
+        DeckFileRow file;
+        file.id = query->value(0).toInt();
+        file.name = query->value(2).toString();
+        file.uploadTime = query->value(3).toDateTime();
+        filesByFolder[query->value(1).toInt()].append(file);
+    }
+
+    Response_DeckList *re = new Response_DeckList;
+    deckListHelper(0, re->mutable_root(), foldersByParent, filesByFolder);
+
     rc.setResponseExtension(re);
     return Response::RespOk;
 }
@@ -429,20 +581,35 @@ Response::ResponseCode AbstractServerSocketInterface::cmdDeckNewDir(const Comman
 void AbstractServerSocketInterface::deckDelDirHelper(int basePathId)
 {
     sqlInterface->checkSql();
-    QSqlQuery *query =
-        sqlInterface->prepareQuery("select id from {prefix}_decklist_folders where id_parent = :id_parent");
-    query->bindValue(":id_parent", basePathId);
-    sqlInterface->execSqlQuery(query);
-    while (query->next())
-        deckDelDirHelper(query->value(0).toInt());
 
-    query = sqlInterface->prepareQuery("delete from {prefix}_decklist_files where id_folder = :id_folder");
-    query->bindValue(":id_folder", basePathId);
-    sqlInterface->execSqlQuery(query);
+    QMap<int, QMap<int, QString>> foldersByParent;
+    if (!loadDeckFolders(foldersByParent))
+        return;
 
-    query = sqlInterface->prepareQuery("delete from {prefix}_decklist_folders where id = :id");
-    query->bindValue(":id", basePathId);
-    sqlInterface->execSqlQuery(query);
+    // the folder and all the folders below it
+    QList<int> folderIds;
+    folderIds.append(basePathId);
+    for (int i = 0; i < folderIds.size(); ++i)
+        folderIds.append(foldersByParent.value(folderIds[i]).keys());
+
+    for (int offset = 0; offset < folderIds.size(); offset += maxDeckFoldersPerStatement) {
+        const QList<int> chunk = folderIds.mid(offset, maxDeckFoldersPerStatement);
+        QStringList placeholders;
+        for (int i = 0; i < chunk.size(); ++i)
+            placeholders.append("?");
+
+        QSqlQuery *query = sqlInterface->prepareQuery("delete from {prefix}_decklist_files where id_folder in (" +
+                                                      placeholders.join(", ") + ")");
+        for (int i = 0; i < chunk.size(); ++i)
+            query->bindValue(i, chunk[i]);
+        sqlInterface->execSqlQuery(query);
+
+        query = sqlInterface->prepareQuery("delete from {prefix}_decklist_folders where id in (" +
+                                           placeholders.join(", ") + ")");
+        for (int i = 0; i < chunk.size(); ++i)
+            query->bindValue(i, chunk[i]);
+        sqlInterface->execSqlQuery(query);
+    }
 }
 
 void AbstractServerSocketInterface::sendServerMessage(const QString userName, const QString message)
@@ -581,20 +748,39 @@ Response::ResponseCode AbstractServerSocketInterface::cmdDeckDownload(const Comm
     return Response::RespOk;
 }
 
-Response::ResponseCode AbstractServerSocketInterface::cmdReplayList(const Command_ReplayList & /*cmd*/,
+static void bindReplayMatchSelection(QSqlQuery *query, int userId, const Command_ReplayList &cmd)
+{
+    query->bindValue(":id_player", userId);
+    if (cmd.limit() > 0) {
+        query->bindValue(":offset", cmd.offset());
+        query->bindValue(":row_count", cmd.limit());
+    }
+}
+
+Response::ResponseCode AbstractServerSocketInterface::cmdReplayList(const Command_ReplayList &cmd,
                                                                     ResponseContainer &rc)
 {
     if (authState != PasswordRight)
         return Response::RespFunctionNotAllowed;
 
-    Response_ReplayList *re = new Response_ReplayList;
+    // The players and replays of all listed matches are fetched with one query each, joined against
+    // the same selection of matches, instead of two queries per match.
+    QString matchSelection = "from {prefix}_replays_access a left join {prefix}_games b on b.id = a.id_game where "
+                             "a.id_player = :id_player and (a.do_not_hide = 1 or date_add(b.time_started, interval 7 "
+                             "day) > now()) order by a.id_game desc";
+    if (cmd.limit() > 0)
+        matchSelection += " limit :offset, :row_count";
+
+    QSqlQuery *query1 = sqlInterface->prepareQuery("select a.id_game, a.replay_name, b.room_name, b.time_started, "
+                                                   "b.time_finished, b.descr, a.do_not_hide " +
+                                                   matchSelection);
+    bindReplayMatchSelection(query1, userInfo->id(), cmd);
+    if (!sqlInterface->execSqlQuery(query1))
+        return Response::RespInternalError;
 
-    QSqlQuery *query1 = sqlInterface->prepareQuery(
-        "select a.id_game, a.replay_name, b.room_name, b.time_started, b.time_finished, b.descr, a.do_not_hide from "
-        "{prefix}_replays_access a left join {prefix}_games b on b.id = a.id_game where a.id_player = :id_player and "
-        "(a.do_not_hide = 1 or date_add(b.time_started, interval 7 day) > now())");
-    query1->bindValue(":id_player", userInfo->id());
-    sqlInterface->execSqlQuery(query1);
+    Response_ReplayList *re = new Response_ReplayList;
+    QHash<int, ServerInfo_ReplayMatch *> matchesByGameId;
+    QHash<int, QString> replayNamesByGameId;
     while (query1->next()) {
         ServerInfo_ReplayMatch *matchInfo = re->add_match_list();
 
@@ -606,28 +792,44 @@ Response::ResponseCode AbstractServerSocketInterface::cmdReplayList(const Comman
         matchInfo->set_time_started(timeStarted);
         matchInfo->set_length(timeFinished - timeStarted);
         matchInfo->set_game_name(query1->value(5).toString().toStdString());
-        const QString replayName = query1->value(1).toString();
         matchInfo->set_do_not_hide(query1->value(6).toBool());
 
-        {
-            QSqlQuery *query2 =
-                sqlInterface->prepareQuery("select player_name from {prefix}_games_players where id_game = :id_game");
-            query2->bindValue(":id_game", gameId);
-            sqlInterface->execSqlQuery(query2);
-            while (query2->next())
-                matchInfo->add_player_names(query2->value(0).toString().toStdString());
+        matchesByGameId.insert(gameId, matchInfo);
+        replayNamesByGameId.insert(gameId, query1->value(1).toString());
+    }
+
+    if (!matchesByGameId.isEmpty()) {
+        QSqlQuery *query2 = sqlInterface->prepareQuery(
+            "select p.id_game, p.player_name from {prefix}_games_players p join (select distinct a.id_game " +
+            matchSelection + ") m on m.id_game = p.id_game");
+        bindReplayMatchSelection(query2, userInfo->id(), cmd);
+        if (!sqlInterface->execSqlQuery(query2)) {
+            delete re;
+            return Response::RespInternalError;
         }
-        {
-            QSqlQuery *query3 =
-                sqlInterface->prepareQuery("select id, duration from {prefix}_replays where id_game = :id_game");
-            query3->bindValue(":id_game", gameId);
-            sqlInterface->execSqlQuery(query3);
-            while (query3->next()) {
-                ServerInfo_Replay *replayInfo = matchInfo->add_replay_list();
-                replayInfo->set_replay_id(query3->value(0).toInt());
-                replayInfo->set_replay_name(replayName.toStdString());
-                replayInfo->set_duration(query3->value(1).toInt());
-            }
+        while (query2->next()) {
+            ServerInfo_ReplayMatch *matchInfo = matchesByGameId.value(query2->value(0).toInt());
+            if (matchInfo)
+                matchInfo->add_player_names(query2->value(1).toString().toStdString());
+        }
+
+        QSqlQuery *query3 = sqlInterface->prepareQuery(
+            "select r.id_game, r.id, r.duration from {prefix}_replays r join (select distinct a.id_game " +
+            matchSelection + ") m on m.id_game = r.id_game order by r.id");
+        bindReplayMatchSelection(query3, userInfo->id(), cmd);
+        if (!sqlInterface->execSqlQuery(query3)) {
+            delete re;
+            return Response::RespInternalError;
+        }
+        while (query3->next()) {
+            const int gameId = query3->value(0).toInt();
+            ServerInfo_ReplayMatch *matchInfo = matchesByGameId.value(gameId);
+            if (!matchInfo)
+                continue;
+            ServerInfo_Replay *replayInfo = matchInfo->add_replay_list();
+            replayInfo->set_replay_id(query3->value(1).toInt());
+            replayInfo->set_replay_name(replayNamesByGameId.value(gameId).toStdString());
+            replayInfo->set_duration(query3->value(2).toInt());
         }
     }
 
@@ -641,7 +843,7 @@ Response::ResponseCode AbstractServerSocketInterface::cmdReplayDownload(const Co
     if (authState != PasswordRight)
         return Response::RespFunctionNotAllowed;
 
-    {
+    if (!cmd.has_max_length()) {
         QSqlQuery *query =
             sqlInterface->prepareQuery("select 1 from {prefix}_replays_access a left join {prefix}_replays b on "
                                        "a.id_game = b.id_game where b.id = :id_replay and a.id_player = :id_player");
@@ -651,19 +853,51 @@ Response::ResponseCode AbstractServerSocketInterface::cmdReplayDownload(const Co
             return Response::RespInternalError;
         if (!query->next())
             return Response::RespAccessDenied;
+
+        query = sqlInterface->prepareQuery("select replay from {prefix}_replays where id = :id_replay");
+        query->bindValue(":id_replay", cmd.replay_id());
+        if (!sqlInterface->execSqlQuery(query))
+            return Response::RespInternalError;
+        if (!query->next())
+            return Response::RespNameNotFound;
+
+        QByteArray data = query->value(0).toByteArray();
+
+        Response_ReplayDownload *re = new Response_ReplayDownload;
+        re->set_replay_data(data.data(), data.size());
+        rc.setResponseExtension(re);
+
+        return Response::RespOk;
     }
 
-    QSqlQuery *query = sqlInterface->prepareQuery("select replay from {prefix}_replays where id = :id_replay");
+    // Chunked download: only the requested piece of the blob leaves the database, which bounds the memory
+    // used here. The database still reads the whole blob for every chunk (length() comes with that read for
+    // free), so a replay of n chunks costs n blob reads there; large chunks keep n small.
+    const quint32 chunkLength = qMin(cmd.max_length(), static_cast<quint32>(maxReplayChunkSize));
+    if (chunkLength == 0)
+        return Response::RespContextError;
+
+    QSqlQuery *query = sqlInterface->prepareQuery(
+        "select substring(b.replay, :offset, :length), length(b.replay) from {prefix}_replays_access a join "
+        "{prefix}_replays b on a.id_game = b.id_game where b.id = :id_replay and a.id_player = :id_player limit 1");
+    query->bindValue(":offset", static_cast<qulonglong>(cmd.offset()) + 1);
+    query->bindValue(":length", chunkLength);
     query->bindValue(":id_replay", cmd.replay_id());
+    query->bindValue(":id_player", userInfo->id());
     if (!sqlInterface->execSqlQuery(query))
         return Response::RespInternalError;
     if (!query->next())
-        return Response::RespNameNotFound;
+        return Response::RespAccessDenied;
 
-    QByteArray data = query->value(0).toByteArray();
+    const QByteArray chunk = query->value(0).toByteArray();
+    const quint64 totalSize = query->value(1).toULongLong();
+    if (cmd.offset() > totalSize)
+        return Response::RespContextError;
 
     Response_ReplayDownload *re = new Response_ReplayDownload;
-    re->set_replay_data(data.data(), data.size());
+    re->set_replay_data(chunk.data(), chunk.size());
+    re->set_offset(cmd.offset());
+    re->set_total_size(totalSize);
     rc.setResponseExtension(re);
 
     return Response::RespOk;
@@ -905,7 +1139,15 @@ Response::ResponseCode AbstractServerSocketInterface::cmdBanFromServer(const Com
     query->bindValue(":reason", QString::fromStdString(cmd.reason()));
     query->bindValue(":visible_reason", QString::fromStdString(cmd.visible_reason()));
     query->bindValue(":client_id", QString::fromStdString(cmd.clientid()));
-    sqlInterface->execSqlQuery(query);
+    if (sqlInterface->execSqlQuery(query) && servatrice->getBanIndex()) {
+        Servatrice_BanIndex::Ban ban;
+        ban.userName = userName;
+        ban.address = address;
+        ban.clientId = QString::fromStdString(cmd.clientid());
+        ban.minutes = minutes;
+        ban.visibleReason = QString::fromStdString(cmd.visible_reason());
+        servatrice->getBanIndex()->addBan(ban);
+    }
 
     servatrice->clientsLock.lockForRead();
     QList<QString> moderatorList = server->getOnlineModeratorList();
@@ -1099,10 +1341,21 @@ Response::ResponseCode AbstractServerSocketInterface::cmdRegisterAccount(const C
         return Response::RespPasswordTooShort;
     }
 
+    // all checks passed: hash the password on the password hash pool, then run the command again
+    if (servatrice->getPasswordHashPool() && !processingDeferredCommand) {
+        CommandContainer cont;
+        if (rc.getCmdId() != -1)
+            cont.set_cmd_id(rc.getCmdId());
+        cont.add_session_command()->MutableExtension(Command_Register::ext)->CopyFrom(cmd);
+        if (!startPasswordHash(cont, password, PasswordHasher::generateRandomSalt()))
+            return Response::RespTooManyRequests;
+        return Response::RespNothing;
+    }
+
     QString token;
     bool requireEmailActivation = settingsCache->value("registration/requireemailactivation", true).toBool();
-    bool regSucceeded = sqlInterface->registerUser(userName, realName, gender, password, emailAddress, country, token,
-                                                   !requireEmailActivation);
+    bool regSucceeded = sqlInterface->registerUser(userName, realName, gender, hashPassword(password), emailAddress,
+                                                   country, token, !requireEmailActivation);
 
     if (regSucceeded) {
         qDebug() << "Accepted register command for user: " << userName;
@@ -1421,7 +1674,7 @@ Response::ResponseCode AbstractServerSocketInterface::cmdReloadConfig(const Comm
                                                                       ResponseContainer & /*rc*/)
 {
     logDebugMessage("Received admin command: reloading configuration");
-    settingsCache->sync();
+    settingsCache->reload();
     QMetaObject::invokeMethod(server, "setRequiredFeatures", Q_ARG(QString, server->getRequiredFeatures()));
     return Response::RespOk;
 }
@@ -1516,12 +1769,13 @@ Response::ResponseCode AbstractServerSocketInterface::cmdAdjustMod(const Command
 TcpServerSocketInterface::TcpServerSocketInterface(Servatrice *_server,
                                                    Servatrice_DatabaseInterface *_databaseInterface,
                                                    QObject *parent)
-    : AbstractServerSocketInterface(_server, _databaseInterface, parent), messageInProgress(false),
-      handshakeStarted(false)
+    : AbstractServerSocketInterface(_server, _databaseInterface, parent), inputBufferPos(0),
+      messageInProgress(false), handshakeStarted(false), messageLength(0)
 {
     socket = new QTcpSocket(this);
     socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
     connect(socket, SIGNAL(readyRead()), this, SLOT(readClient()));
+    connect(socket, SIGNAL(bytesWritten(qint64)), this, SLOT(flushOutputQueue()), Qt::QueuedConnection);
     connect(socket, SIGNAL(error(QAbstractSocket::SocketError)), this,
             SLOT(catchSocketError(QAbstractSocket::SocketError)));
     connect(socket, SIGNAL(disconnected()), this, SLOT(catchSocketDisconnected()));
@@ -1541,7 +1795,9 @@ void TcpServerSocketInterface::initConnection(int socketDescriptor)
     server->addClient(this);
 
     socket->setSocketDescriptor(socketDescriptor);
-    logger->logMessage(QString("Incoming connection: %1").arg(socket->peerAddress().toString()), this);
+    address = socket->peerAddress();
+    servatrice->addClientAddress(this);
+    logger->logMessage(QString("Incoming connection: %1").arg(address.toString()), this);
     initSessionDeprecated();
 }
 
@@ -1557,35 +1813,45 @@ void TcpServerSocketInterface::initSessionDeprecated()
 
 void TcpServerSocketInterface::flushOutputQueue()
 {
+    // While the socket still holds more than the high-water mark, keep new messages in outputQueue;
+    // the bytesWritten() connection brings us back here once the peer has caught up.
+    const int highWaterMark = servatrice->getTcpOutputHighWaterMark();
+    if (highWaterMark > 0 && socket->bytesToWrite() > highWaterMark) {
+        outputQueueMutex.lock();
+        const bool overflow = outputQueueBytes > highWaterMark;
+        outputQueueMutex.unlock();
+        if (overflow) {
+            logger->logMessage(QString("Output buffer limit exceeded for %1, closing connection").arg(getAddress()),
+                               this);
+            prepareDestroy();
+        }
+        return;
+    }
+
     QMutexLocker locker(&outputQueueMutex);
     if (outputQueue.isEmpty())
         return;
 
-    int totalBytes = 0;
-    while (!outputQueue.isEmpty()) {
-        ServerMessage item = outputQueue.takeFirst();
-        locker.unlock();
-
-        QByteArray buf;
-#if GOOGLE_PROTOBUF_VERSION > 3001000
-        unsigned int size = item.ByteSizeLong();
-#else
-        unsigned int size = item.ByteSize();
-#endif
-        buf.resize(size + 4);
-        item.SerializeToArray(buf.data() + 4, size);
-        buf.data()[3] = (unsigned char)size;
-        buf.data()[2] = (unsigned char)(size >> 8);
-        buf.data()[1] = (unsigned char)(size >> 16);
-        buf.data()[0] = (unsigned char)(size >> 24);
-        // In case socket->write() calls catchSocketError(), the mutex must not be locked during this call.
-        writeToSocket(buf);
+    QList<QByteArray> pending;
+    pending.swap(outputQueue);
+    const int pendingBytes = outputQueueBytes;
+    outputQueueBytes = 0;
+    locker.unlock();
 
-        totalBytes += size + 4;
-        locker.relock();
+    // coalesce all pending messages into a single send buffer
+    QByteArray buf;
+    buf.reserve(pendingBytes + 4 * pending.size());
+    for (const QByteArray &item : pending) {
+        const unsigned int size = item.size();
+        const char header[4] = {(char)(unsigned char)(size >> 24), (char)(unsigned char)(size >> 16),
+                                (char)(unsigned char)(size >> 8), (char)(unsigned char)size};
+        buf.append(header, 4);
+        buf.append(item);
     }
-    locker.unlock();
-    servatrice->incTxBytes(totalBytes);
+
+    // In case socket->write() calls catchSocketError(), the mutex must not be locked during this call.
+    writeToSocket(buf);
+    servatrice->incTxBytes(buf.size());
     // see above wrt mutex
     flushSocket();
 }
@@ -1598,22 +1864,41 @@ void TcpServerSocketInterface::readClient()
 
     do {
         if (!messageInProgress) {
-            if (inputBuffer.size() >= 4) {
-                messageLength = (((quint32)(unsigned char)inputBuffer[0]) << 24) +
-                                (((quint32)(unsigned char)inputBuffer[1]) << 16) +
-                                (((quint32)(unsigned char)inputBuffer[2]) << 8) +
-                                ((quint32)(unsigned char)inputBuffer[3]);
-                inputBuffer.remove(0, 4);
+            if (inputBuffer.size() - inputBufferPos >= 4) {
+                const char *header = inputBuffer.constData() + inputBufferPos;
+                const quint32 length = (((quint32)(unsigned char)header[0]) << 24) +
+                                       (((quint32)(unsigned char)header[1]) << 16) +
+                                       (((quint32)(unsigned char)header[2]) << 8) +
+                                       ((quint32)(unsigned char)header[3]);
+                inputBufferPos += 4;
+
+                // drop the client before it gets the chance to make us buffer an arbitrarily large frame
+                const int maxMessageSize = servatrice->getMaxTcpMessageSize();
+                if (length > (quint32)std::numeric_limits<int>::max() ||
+                    (maxMessageSize > 0 && length > (quint32)maxMessageSize)) {
+                    logger->logMessage(QString("Oversized message (%1 bytes) from %2, closing connection")
+                                           .arg(length)
+                                           .arg(getAddress()),
+                                       this);
+                    inputBuffer.clear();
+                    inputBufferPos = 0;
+                    prepareDestroy();
+                    return;
+                }
+
+                messageLength = (int)length;
                 messageInProgress = true;
             } else
-                return;
+                break;
         }
-        if (inputBuffer.size() < messageLength || messageLength < 0)
-            return;
+        if (inputBuffer.size() - inputBufferPos < messageLength)
+            break;
 
+        // parse in place, the consumed bytes stay in the buffer until the next compaction
+        const char *message = inputBuffer.constData() + inputBufferPos;
         CommandContainer newCommandContainer;
         try {
-            newCommandContainer.ParseFromArray(inputBuffer.data(), messageLength);
+            newCommandContainer.ParseFromArray(message, messageLength);
         } catch (std::exception &e) {
             qDebug() << "Caught std::exception in" << __FILE__ << __LINE__ <<
 #ifdef _MSC_VER // Visual Studio
@@ -1624,7 +1909,7 @@ void TcpServerSocketInterface::readClient()
             qDebug() << "Exception:" << e.what();
             qDebug() << "Message coming from:" << getAddress();
             qDebug() << "Message length:" << messageLength;
-            qDebug() << "Message content:" << inputBuffer.toHex();
+            qDebug() << "Message content:" << QByteArray::fromRawData(message, messageLength).toHex();
         } catch (...) {
             qDebug() << "Unhandled exception in" << __FILE__ << __LINE__ <<
 #ifdef _MSC_VER // Visual Studio
@@ -1635,7 +1920,7 @@ void TcpServerSocketInterface::readClient()
             qDebug() << "Message coming from:" << getAddress();
         }
 
-        inputBuffer.remove(0, messageLength);
+        inputBufferPos += messageLength;
         messageInProgress = false;
 
         // dirty hack to make v13 client display the correct error message
@@ -1647,7 +1932,25 @@ void TcpServerSocketInterface::readClient()
                 prepareDestroy();
         }
         // end of hack
-    } while (!inputBuffer.isEmpty());
+    } while (inputBufferPos < inputBuffer.size());
+
+    compactInputBuffer();
+}
+
+void TcpServerSocketInterface::compactInputBuffer()
+{
+    if (inputBufferPos == 0)
+        return;
+
+    if (inputBufferPos >= inputBuffer.size()) {
+        inputBuffer.clear();
+        inputBufferPos = 0;
+    } else if (inputBufferPos >= inputBuffer.size() / 2) {
+        // only move the unread tail once it is smaller than what has already been consumed,
+        // which keeps the cost of compacting linear in the amount of data received
+        inputBuffer.remove(0, inputBufferPos);
+        inputBufferPos = 0;
+    }
 }
 
 bool TcpServerSocketInterface::initTcpSession()
@@ -1719,6 +2022,7 @@ void WebsocketServerSocketInterface::initConnection(void *_socket)
     // Add this object to the server's list of connections before it can receive socket events.
     // Otherwise, in case a of a socket error, it could be removed from the list before it is added.
     server->addClient(this);
+    servatrice->addClientAddress(this);
 
     logger->logMessage(
         QString("Incoming websocket connection: %1 (%2)").arg(address.toString()).arg(socket->peerAddress().toString()),
@@ -1761,26 +2065,17 @@ void WebsocketServerSocketInterface::flushOutputQueue()
     if (outputQueue.isEmpty())
         return;
 
-    int totalBytes = 0;
-    while (!outputQueue.isEmpty()) {
-        ServerMessage item = outputQueue.takeFirst();
-        locker.unlock();
+    // every ServerMessage has to be its own websocket frame, but the queue is taken in one go
+    QList<QByteArray> pending;
+    pending.swap(outputQueue);
+    const int totalBytes = outputQueueBytes;
+    outputQueueBytes = 0;
+    locker.unlock();
 
-        QByteArray buf;
-#if GOOGLE_PROTOBUF_VERSION > 3001000
-        unsigned int size = item.ByteSizeLong();
-#else
-        unsigned int size = item.ByteSize();
-#endif
-        buf.resize(size);
-        item.SerializeToArray(buf.data(), size);
+    for (QByteArray &buf : pending) {
         // In case socket->write() calls catchSocketError(), the mutex must not be locked during this call.
         writeToSocket(buf);
-
-        totalBytes += size;
-        locker.relock();
     }
-    locker.unlock();
     servatrice->incTxBytes(totalBytes);
     // see above wrt mutex
     flushSocket();
@@ -22,7 +22,9 @@
 
 #include "server_protocolhandler.h"
 
+#include <QDateTime>
 #include <QHostAddress>
+#include <QMap>
 #include <QMutex>
 #include <QTcpSocket>
 #include <QWebSocket>
@@ -61,28 +63,60 @@ protected slots:
     void catchSocketError(QAbstractSocket::SocketError socketError);
     void catchSocketDisconnected();
     virtual void flushOutputQueue() = 0;
+private slots:
+    void passwordHashComputed(const QString &password, const QString &salt, const QString &hash);
 signals:
     void outputQueueChanged();
 
 protected:
     void logDebugMessage(const QString &message);
+    bool isCommandLogged(CommandLogCategory category, int commandType);
+    bool deferCommandContainer(const CommandContainer &cont);
+    QString getPreparedPasswordHash(const QString &password) const override;
+    // Hashes password on the password hash pool and processes cont again with the hash prepared
+    bool startPasswordHash(const CommandContainer &cont, const QString &password, const QString &salt);
     bool tooManyRegistrationAttempts(const QString &ipAddress);
 
     virtual void writeToSocket(QByteArray &data) = 0;
     virtual void flushSocket() = 0;
 
     Servatrice *servatrice;
-    QList<ServerMessage> outputQueue;
+    QList<QByteArray> outputQueue; // serialized ServerMessages, possibly shared with other recipients
+    int outputQueueBytes;
     QMutex outputQueueMutex;
 
 private:
     Servatrice_DatabaseInterface *sqlInterface;
+    int commandLogCounter;
+
+    // A login or registration waiting for its password hash, and the hash once it has been computed
+    struct PreparedPasswordHash
+    {
+        QString password, salt, hash;
+    };
+    CommandContainer *deferredCommandContainer;
+    bool processingDeferredCommand;
+    PreparedPasswordHash preparedPasswordHash;
 
     Response::ResponseCode cmdAddToList(const Command_AddToList &cmd, ResponseContainer &rc);
     Response::ResponseCode cmdRemoveFromList(const Command_RemoveFromList &cmd, ResponseContainer &rc);
     int getDeckPathId(int basePathId, QStringList path);
     int getDeckPathId(const QString &path);
-    bool deckListHelper(int folderId, ServerInfo_DeckStorage_Folder *folder);
+    struct DeckFileRow
+    {
+        int id;
+        QString name;
+        QDateTime uploadTime;
+    };
+    static const int maxDeckFoldersPerStatement = 100;
+    // Every chunk reads the whole replay blob in the database, so chunks are kept large
+    static const int maxReplayChunkSize = 1024 * 1024;
+    // All deck folders of the user: parent id -> (folder id -> name)
+    bool loadDeckFolders(QMap<int, QMap<int, QString>> &foldersByParent);
+    void deckListHelper(int folderId,
+                        ServerInfo_DeckStorage_Folder *folder,
+                        const QMap<int, QMap<int, QString>> &foldersByParent,
+                        const QMap<int, QList<DeckFileRow>> &filesByFolder);
     Response::ResponseCode cmdDeckList(const Command_DeckList &cmd, ResponseContainer &rc);
     Response::ResponseCode cmdDeckNewDir(const Command_DeckNewDir &cmd, ResponseContainer &rc);
     void deckDelDirHelper(int basePathId);
@@ -130,13 +164,16 @@ public:
     AbstractServerSocketInterface(Servatrice *_server,
                                   Servatrice_DatabaseInterface *_databaseInterface,
                                   QObject *parent = 0);
-    ~AbstractServerSocketInterface(){};
+    ~AbstractServerSocketInterface();
     bool initSession();
+    // Salted hash of password (a new salt if none is given); reuses the hash computed by the password hash pool
+    QString hashPassword(const QString &password, const QString &salt = QString());
 
     virtual QHostAddress getPeerAddress() const = 0;
     virtual QString getAddress() const = 0;
 
     void transmitProtocolItem(const ServerMessage &item);
+    void transmitSerializedProtocolItem(const QByteArray &item);
 };
 
 class TcpServerSocketInterface : public AbstractServerSocketInterface
@@ -150,11 +187,11 @@ public:
 
     QHostAddress getPeerAddress() const
     {
-        return socket->peerAddress();
+        return address;
     }
     QString getAddress() const
     {
-        return socket->peerAddress().toString();
+        return address.toString();
     }
     QString getConnectionType() const
     {
@@ -163,11 +200,15 @@ public:
 
 private:
     QTcpSocket *socket;
+    QHostAddress address; // kept after the socket disconnects, see Servatrice::removeClient()
     QByteArray inputBuffer;
+    int inputBufferPos; // read cursor into inputBuffer, consumed bytes are compacted lazily
     bool messageInProgress;
     bool handshakeStarted;
     int messageLength;
 
+    void compactInputBuffer();
+
 protected:
     void writeToSocket(QByteArray &data)
     {
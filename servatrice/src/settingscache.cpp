@@ -1,12 +1,70 @@
 #include "settingscache.h"
 
+#include "pb/admin_commands.pb.h"
+#include "pb/game_commands.pb.h"
+#include "pb/moderator_commands.pb.h"
+#include "pb/room_commands.pb.h"
+#include "pb/session_commands.pb.h"
+
 #include <QCoreApplication>
 #include <QDebug>
 #include <QFile>
 #include <QStandardPaths>
 
+SettingsSnapshot::SettingsSnapshot(const QSettings &settings)
+    : clientKeepAlive(settings.value("server/clientkeepalive", 1).toInt()),
+      maxPlayerInactivityTime(settings.value("server/max_player_inactivity_time", 15).toInt()),
+      idleClientTimeout(settings.value("server/idleclienttimeout", 3600).toInt()),
+      maxGameInactivityTime(settings.value("game/max_game_inactivity_time", 120).toInt()),
+      maxUsersPerAddress(settings.value("security/max_users_per_address", 4).toInt()),
+      messageCountingInterval(settings.value("security/message_counting_interval", 10).toInt()),
+      maxMessageCountPerInterval(settings.value("security/max_message_count_per_interval", 15).toInt()),
+      maxMessageSizePerInterval(settings.value("security/max_message_size_per_interval", 1000).toInt()),
+      maxGamesPerUser(settings.value("security/max_games_per_user", 5).toInt()),
+      commandCountingInterval(settings.value("game/command_counting_interval", 10).toInt()),
+      maxCommandCountPerInterval(settings.value("game/max_command_count_per_interval", 20).toInt()),
+      maxTcpMessageSize(settings.value("security/max_message_size", 1048576).toInt()),
+      tcpOutputHighWaterMark(settings.value("security/output_buffer_high_water_mark", 4194304).toInt()),
+      storeReplays(settings.value("game/store_replays", true).toBool()),
+      writeLog(settings.value("server/writelog", 1).toBool()),
+      commandLogLevel(settings.value("server/commandloglevel", 3).toInt()),
+      commandLogSampling(qMax(settings.value("server/commandlogsampling", 1).toInt(), 1))
+{
+    const QString filters = settings.value("server/logfilters").toString();
+    if (!filters.trimmed().isEmpty())
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 14, 0))
+        logFilters = filters.split(",", Qt::SkipEmptyParts);
+#else
+        logFilters = filters.split(",", QString::SkipEmptyParts);
+#endif
+
+    // resolve the excluded command names once, so that the per-command check is a set lookup
+    const QStringList excludedCommands = settings.value("server/commandlogexclude").toString().split(",");
+    for (const QString &excludedCommand : excludedCommands) {
+        const std::string name = excludedCommand.trimmed().toUpper().toStdString();
+        if (name.empty())
+            continue;
+
+        SessionCommand::SessionCommandType sessionCommand;
+        if (SessionCommand::SessionCommandType_Parse(name, &sessionCommand))
+            commandLogExcludedSession.insert(sessionCommand);
+        RoomCommand::RoomCommandType roomCommand;
+        if (RoomCommand::RoomCommandType_Parse(name, &roomCommand))
+            commandLogExcludedRoom.insert(roomCommand);
+        GameCommand::GameCommandType gameCommand;
+        if (GameCommand::GameCommandType_Parse(name, &gameCommand))
+            commandLogExcludedGame.insert(gameCommand);
+        ModeratorCommand::ModeratorCommandType moderatorCommand;
+        if (ModeratorCommand::ModeratorCommandType_Parse(name, &moderatorCommand))
+            commandLogExcludedModerator.insert(moderatorCommand);
+        AdminCommand::AdminCommandType adminCommand;
+        if (AdminCommand::AdminCommandType_Parse(name, &adminCommand))
+            commandLogExcludedAdmin.insert(adminCommand);
+    }
+}
+
 SettingsCache::SettingsCache(const QString &fileName, QSettings::Format format, QObject *parent)
-    : QSettings(fileName, format, parent)
+    : QSettings(fileName, format, parent), currentSnapshot(new SettingsSnapshot(*this))
 {
     // first, figure out if we are running in portable mode
     isPortableBuild = QFile::exists(qApp->applicationDirPath() + "/portable.dat");
@@ -23,6 +81,20 @@ SettingsCache::SettingsCache(const QString &fileName, QSettings::Format format,
     }
 }
 
+SettingsCache::~SettingsCache()
+{
+    delete currentSnapshot.loadAcquire();
+    qDeleteAll(retiredSnapshots);
+}
+
+void SettingsCache::reload()
+{
+    QMutexLocker locker(&reloadMutex);
+    sync();
+    const SettingsSnapshot *oldSnapshot = currentSnapshot.fetchAndStoreOrdered(new SettingsSnapshot(*this));
+    retiredSnapshots.append(oldSnapshot);
+}
+
 QString SettingsCache::guessConfigurationPath(QString &specificPath)
 {
     const QString fileName = "servatrice.ini";
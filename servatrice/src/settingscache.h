@@ -1,27 +1,72 @@
 #ifndef SERVATRICE_SETTINGSCACHE_H
 #define SERVATRICE_SETTINGSCACHE_H
 
+#include <QAtomicPointer>
 #include <QList>
+#include <QMutex>
 #include <QRegExp>
+#include <QSet>
 #include <QSettings>
 #include <QString>
+#include <QStringList>
+
+/*
+ * Typed copy of the settings that are read on hot paths (e.g. every client's ping clock tick).
+ * A snapshot is never modified after creation; a configuration reload publishes a new one.
+ */
+struct SettingsSnapshot
+{
+    int clientKeepAlive;
+    int maxPlayerInactivityTime;
+    int idleClientTimeout;
+    int maxGameInactivityTime;
+    int maxUsersPerAddress;
+    int messageCountingInterval;
+    int maxMessageCountPerInterval;
+    int maxMessageSizePerInterval;
+    int maxGamesPerUser;
+    int commandCountingInterval;
+    int maxCommandCountPerInterval;
+    int maxTcpMessageSize;
+    int tcpOutputHighWaterMark;
+    bool storeReplays;
+    bool writeLog;
+    QStringList logFilters;
+    int commandLogLevel;
+    int commandLogSampling;
+    QSet<int> commandLogExcludedSession, commandLogExcludedRoom, commandLogExcludedGame,
+        commandLogExcludedModerator, commandLogExcludedAdmin;
+
+    explicit SettingsSnapshot(const QSettings &settings);
+};
 
 class SettingsCache : public QSettings
 {
     Q_OBJECT
 private:
     bool isPortableBuild;
+    QAtomicPointer<const SettingsSnapshot> currentSnapshot;
+    // Readers never hold a reference to a snapshot, so replaced ones are kept around until shutdown.
+    // Reloads are rare and admin triggered, so this stays tiny.
+    QList<const SettingsSnapshot *> retiredSnapshots;
+    QMutex reloadMutex;
 
 public:
     SettingsCache(const QString &fileName = "servatrice.ini",
                   QSettings::Format format = QSettings::IniFormat,
                   QObject *parent = 0);
+    ~SettingsCache();
     static QString guessConfigurationPath(QString &specificPath);
     QList<QRegExp> disallowedRegExp;
     bool getIsPortableBuild() const
     {
         return isPortableBuild;
     }
+    const SettingsSnapshot *snapshot() const
+    {
+        return currentSnapshot.loadAcquire();
+    }
+    void reload();
 };
 
 extern SettingsCache *settingsCache;
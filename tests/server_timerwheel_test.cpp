@@ -0,0 +1,163 @@
+#include "../common/server_timerwheel.h"
+#include "gtest/gtest.h"
+
+#include <QCoreApplication>
+
+namespace
+{
+
+class CountingClient : public Server_TimerWheelClient
+{
+public:
+    int ticks;
+    Server_TimerWheelClient *unscheduleOnTick;
+
+    CountingClient() : ticks(0), unscheduleOnTick(nullptr)
+    {
+    }
+    ~CountingClient() override
+    {
+        Server_TimerWheel::forCurrentThread()->unschedule(this);
+    }
+    void timerWheelTick() override
+    {
+        ++ticks;
+        if (unscheduleOnTick)
+            Server_TimerWheel::forCurrentThread()->unschedule(unscheduleOnTick);
+    }
+};
+
+void tick(int count = 1)
+{
+    for (int i = 0; i < count; ++i)
+        QMetaObject::invokeMethod(Server_TimerWheel::forCurrentThread(), "tick");
+}
+
+TEST(TimerWheel, FiresOnItsPeriod)
+{
+    CountingClient client;
+    Server_TimerWheel::forCurrentThread()->schedule(&client, 3);
+
+    tick(2);
+    ASSERT_EQ(client.ticks, 0);
+    tick();
+    ASSERT_EQ(client.ticks, 1);
+    tick(3);
+    ASSERT_EQ(client.ticks, 2);
+}
+
+TEST(TimerWheel, ClientsInDifferentSlots)
+{
+    CountingClient everySecond, everyFiveSeconds;
+    Server_TimerWheel::forCurrentThread()->schedule(&everySecond, 1);
+    Server_TimerWheel::forCurrentThread()->schedule(&everyFiveSeconds, 5);
+
+    tick(10);
+    ASSERT_EQ(everySecond.ticks, 10);
+    ASSERT_EQ(everyFiveSeconds.ticks, 2);
+}
+
+TEST(TimerWheel, PeriodOfOneRevolution)
+{
+    CountingClient client;
+    Server_TimerWheel::forCurrentThread()->schedule(&client, 64);
+
+    tick(63);
+    ASSERT_EQ(client.ticks, 0);
+    tick();
+    ASSERT_EQ(client.ticks, 1);
+    tick(64);
+    ASSERT_EQ(client.ticks, 2);
+}
+
+TEST(TimerWheel, PeriodLongerThanTheWheelWrapsAround)
+{
+    CountingClient client;
+    Server_TimerWheel::forCurrentThread()->schedule(&client, 100);
+
+    tick(99);
+    ASSERT_EQ(client.ticks, 0);
+    tick();
+    ASSERT_EQ(client.ticks, 1);
+    tick(99);
+    ASSERT_EQ(client.ticks, 1);
+    tick();
+    ASSERT_EQ(client.ticks, 2);
+}
+
+TEST(TimerWheel, RescheduleRestartsThePeriod)
+{
+    CountingClient client;
+    Server_TimerWheel::forCurrentThread()->schedule(&client, 5);
+
+    tick(3);
+    Server_TimerWheel::forCurrentThread()->schedule(&client, 5);
+    ASSERT_EQ(Server_TimerWheel::forCurrentThread()->getClientCount(), 1);
+
+    tick(4);
+    ASSERT_EQ(client.ticks, 0);
+    tick();
+    ASSERT_EQ(client.ticks, 1);
+}
+
+TEST(TimerWheel, RescheduleWithAnotherPeriod)
+{
+    CountingClient client;
+    Server_TimerWheel::forCurrentThread()->schedule(&client, 2);
+    Server_TimerWheel::forCurrentThread()->schedule(&client, 70);
+
+    tick(69);
+    ASSERT_EQ(client.ticks, 0);
+    tick();
+    ASSERT_EQ(client.ticks, 1);
+}
+
+TEST(TimerWheel, Unschedule)
+{
+    CountingClient client;
+    Server_TimerWheel::forCurrentThread()->schedule(&client, 1);
+    tick();
+    Server_TimerWheel::forCurrentThread()->unschedule(&client);
+    ASSERT_EQ(Server_TimerWheel::forCurrentThread()->getClientCount(), 0);
+
+    tick(10);
+    ASSERT_EQ(client.ticks, 1);
+}
+
+TEST(TimerWheel, UnscheduleItselfDuringTick)
+{
+    CountingClient client;
+    client.unscheduleOnTick = &client;
+    Server_TimerWheel::forCurrentThread()->schedule(&client, 2);
+
+    tick(10);
+    ASSERT_EQ(client.ticks, 1);
+    ASSERT_EQ(Server_TimerWheel::forCurrentThread()->getClientCount(), 0);
+}
+
+TEST(TimerWheel, UnscheduleAnotherDueClientDuringTick)
+{
+    // both are due in the same slot, whichever ticks first unschedules the other
+    CountingClient first, second;
+    first.unscheduleOnTick = &second;
+    second.unscheduleOnTick = &first;
+    Server_TimerWheel::forCurrentThread()->schedule(&first, 4);
+    Server_TimerWheel::forCurrentThread()->schedule(&second, 4);
+
+    tick(4);
+    ASSERT_EQ(first.ticks + second.ticks, 1);
+    ASSERT_EQ(Server_TimerWheel::forCurrentThread()->getClientCount(), 1);
+
+    tick(4);
+    ASSERT_EQ(first.ticks + second.ticks, 2);
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    // the wheel's QTimer needs an event dispatcher
+    QCoreApplication app(argc, argv);
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}